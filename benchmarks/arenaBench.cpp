@@ -0,0 +1,231 @@
+/**
+ * @file arenaBench.cpp
+ * Benchmark comparing tree nodes allocated from the free store with nodes
+ * allocated from NUMA local, huge page backed, arenas.
+ *
+ * Usage: arenaBench [iterations] [threads]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TreeNode.h"
+#include "NodeArena.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+/**
+ * Simple uniform random reward generator.
+ */
+struct SimpleBandit_m
+{
+   double operator()(int action)
+   {
+      return static_cast<double>(rand()%RAND_MAX)/RAND_MAX;
+   }
+};
+
+/**
+ * Cheap thread safe random number generator, so that threads do not
+ * serialise on the state behind rand().
+ */
+struct LocalRand_m
+{
+   unsigned long state;
+
+   LocalRand_m() : state(88172645463325252UL) {}
+
+   double operator()()
+   {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      return (state >> 11) * (1.0/9007199254740992.0);
+   }
+};
+
+/**
+ * Reward generator using LocalRand_m.
+ */
+struct LocalBandit_m
+{
+   LocalRand_m rand;
+
+   double operator()(int action)
+   {
+      return rand();
+   }
+};
+
+const int N_ACTIONS = 8;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Returns the number of seconds since \c start.
+ */
+double elapsed(Clock::time_point start)
+{
+   return std::chrono::duration<double>(Clock::now()-start).count();
+}
+
+/**
+ * Grows a tree by a number of iterations.
+ */
+template<class Tree> void grow(Tree* pTree, int nIterations)
+{
+   LocalBandit_m bandit;
+   for(int k=0; k<nIterations; ++k)
+   {
+      pTree->iterate(bandit);
+   }
+}
+
+/**
+ * Runs all measurements for one storage policy, and prints one row of
+ * results.
+ */
+template<class Storage> void run
+(
+ const std::string& name,
+ int nIterations,
+ int nThreads
+)
+{
+   typedef mcts::UCTreeNode<N_ACTIONS,LocalRand_m,Storage> Tree;
+
+   //***************************************************************************
+   // Single threaded iterations per second
+   //***************************************************************************
+   Tree tree;
+   Clock::time_point start = Clock::now();
+   grow(&tree,nIterations);
+   double singleRate = nIterations / elapsed(start);
+
+   //***************************************************************************
+   // Pointer chasing traversal of the resulting tree, which is dominated by
+   // cache and TLB misses once the tree is much larger than the cache.
+   //***************************************************************************
+   const int N_PASSES = 5;
+   long nVisited = 0;
+   start = Clock::now();
+   for(int k=0; k<N_PASSES; ++k)
+   {
+      nVisited += tree.numOfNodes();
+   }
+   double nsPerNode = 1e9*elapsed(start)/nVisited;
+
+   //***************************************************************************
+   // Multithreaded iterations per second, with each thread growing its own
+   // tree, and so expanding into its own local arena.
+   //***************************************************************************
+   std::vector<Tree*> trees;
+   std::vector<std::thread> threads;
+   start = Clock::now();
+   for(int k=0; k<nThreads; ++k)
+   {
+      trees.push_back(new Tree());
+      threads.push_back(std::thread(grow<Tree>,trees.back(),nIterations));
+   }
+   for(int k=0; k<nThreads; ++k)
+   {
+      threads[k].join();
+   }
+   double multiRate = nThreads*nIterations / elapsed(start);
+   for(int k=0; k<nThreads; ++k)
+   {
+      delete trees[k];
+   }
+
+   std::cout << std::setw(24) << std::left << name << std::right <<
+      std::setw(14) << static_cast<long>(singleRate) <<
+      std::setw(14) << static_cast<long>(multiRate) <<
+      std::setw(14) << std::setprecision(3) << nsPerNode << std::endl;
+
+} // run
+
+/**
+ * Tag used to select the pool for arena backed trees.
+ */
+struct BenchTag_m {};
+
+typedef mcts::ArenaStorage<BenchTag_m> BenchStorage_m;
+
+/**
+ * Configures the arena pool, and runs the benchmark with it.
+ */
+void runArena
+(
+ const std::string& name,
+ const mcts::ArenaOptions& options,
+ int nIterations,
+ int nThreads
+)
+{
+   BenchStorage_m::configure(options);
+   run<BenchStorage_m>(name,nIterations,nThreads);
+   mcts::ArenaStats stats = BenchStorage_m::pool().stats();
+   std::cout << "   arenas: " << stats.nArenas << " chunks: " <<
+      stats.nChunks << " explicit huge: " << stats.nHugeChunks <<
+      " numa bound: " << stats.nBoundChunks << std::endl;
+}
+
+} // module namespace
+
+/**
+ * Runs the benchmark.
+ */
+int main(int argc, char* argv[])
+{
+   try
+   {
+      int nIterations = 50000;
+      int nThreads = std::thread::hardware_concurrency();
+      if(1<argc)
+      {
+         nIterations = std::atoi(argv[1]);
+      }
+      if(2<argc)
+      {
+         nThreads = std::atoi(argv[2]);
+      }
+      if(1>nThreads)
+      {
+         nThreads = 1;
+      }
+
+      std::cout << "iterations per thread: " << nIterations <<
+         " threads: " << nThreads << " numa nodes: " <<
+         mcts::numa::numOfNodes() << std::endl;
+      std::cout << std::setw(24) << std::left << "storage" << std::right <<
+         std::setw(14) << "iter/s" << std::setw(14) << "iter/s (MT)" <<
+         std::setw(14) << "ns/node" << std::endl;
+
+      run<mcts::HeapStorage>("heap",nIterations,nThreads);
+      runArena("arena",mcts::ArenaOptions(mcts::ARENA_PER_THREAD,
+         mcts::NORMAL_PAGES,false),nIterations,nThreads);
+      runArena("arena+numa",mcts::ArenaOptions(mcts::ARENA_PER_THREAD,
+         mcts::NORMAL_PAGES,true),nIterations,nThreads);
+      runArena("arena+numa+thp",mcts::ArenaOptions(mcts::ARENA_PER_THREAD,
+         mcts::TRANSPARENT_HUGE_PAGES,true),nIterations,nThreads);
+      runArena("arena+numa+hugetlb",mcts::ArenaOptions(mcts::ARENA_PER_THREAD,
+         mcts::EXPLICIT_HUGE_PAGES,true),nIterations,nThreads);
+      runArena("node-arena+numa+thp",mcts::ArenaOptions
+         (mcts::ARENA_PER_NUMA_NODE,mcts::TRANSPARENT_HUGE_PAGES,true),
+         nIterations,nThreads);
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
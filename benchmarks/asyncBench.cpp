@@ -0,0 +1,116 @@
+/**
+ * @file asyncBench.cpp
+ * Benchmark comparing blocking and coroutine based MCTS iterations against a
+ * simulator process with a fixed latency per step.
+ *
+ * Usage: asyncBench [latency in ms] [iterations] [max in flight] [simServer]
+ *
+ * By default, the simulator is expected to be in the same directory as this
+ * benchmark.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "TreeNode.h"
+#include "AsyncSearch.h"
+#include "SimulatorClient.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+const int N_ACTIONS = 8;
+
+typedef mcts::UCTreeNode<N_ACTIONS> Tree_m;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Prints one row of results.
+ */
+void report(const std::string& name, int nIterations, double time)
+{
+   std::cout << std::setw(16) << std::left << name << std::right <<
+      std::setw(12) << nIterations << std::setw(12) << std::setprecision(4) <<
+      time << std::setw(14) << nIterations/time << std::endl;
+}
+
+} // module namespace
+
+/**
+ * Runs the benchmark.
+ */
+int main(int argc, char* argv[])
+{
+   try
+   {
+      std::string latency = "0.5";
+      int nIterations = 2000;
+      int maxInFlight = 256;
+      std::string path = argv[0];
+      path = path.substr(0,path.find_last_of('/')+1) + "simServer";
+      if(1<argc)
+      {
+         latency = argv[1];
+      }
+      if(2<argc)
+      {
+         nIterations = std::atoi(argv[2]);
+      }
+      if(3<argc)
+      {
+         maxInFlight = std::atoi(argv[3]);
+      }
+      if(4<argc)
+      {
+         path = argv[4];
+      }
+
+      std::vector<std::string> args;
+      args.push_back(latency);
+      mcts::SimulatorClient client(path,args);
+      std::cout << "latency: " << latency << "ms, max in flight: " <<
+         maxInFlight << ", rollout steps: " << mcts::MAX_ROLLOUT_ITERATIONS <<
+         std::endl;
+      std::cout << std::setw(16) << std::left << "method" << std::right <<
+         std::setw(12) << "iterations" << std::setw(12) << "seconds" <<
+         std::setw(14) << "iter/s" << std::endl;
+
+      //************************************************************************
+      // Blocking iterations are slow, so we run fewer of them.
+      //************************************************************************
+      {
+         const int N_BLOCKING = nIterations/maxInFlight + 1;
+         Tree_m tree;
+         mcts::BlockingSimGenerator mdp(client);
+         Clock::time_point start = Clock::now();
+         for(int k=0; k<N_BLOCKING; ++k)
+         {
+            tree.iterate(mdp);
+         }
+         report("blocking",N_BLOCKING,std::chrono::duration<double>
+            (Clock::now()-start).count());
+      }
+
+      {
+         Tree_m tree;
+         mcts::AsyncSimGenerator mdp(client);
+         Clock::time_point start = Clock::now();
+         mcts::searchAsync(tree,mdp,client,nIterations,maxInFlight);
+         report("coroutines",nIterations,std::chrono::duration<double>
+            (Clock::now()-start).count());
+      }
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
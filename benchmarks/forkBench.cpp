@@ -0,0 +1,163 @@
+/**
+ * @file forkBench.cpp
+ * Benchmark comparing the time and memory cost of copy-on-write forks with
+ * deep copies of a tree.
+ *
+ * Usage: forkBench [iterations] [iterations after fork]
+ */
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "TreeNode.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+/**
+ * Simple uniform random reward generator.
+ */
+struct SimpleBandit_m
+{
+   double operator()(int action)
+   {
+      return static_cast<double>(rand()%RAND_MAX)/RAND_MAX;
+   }
+};
+
+/**
+ * Storage policy which counts the number of nodes currently allocated.
+ */
+struct CountingStorage_m
+{
+   static long nLive;
+
+   static void* allocate(std::size_t size)
+   {
+      ++nLive;
+      return mcts::HeapStorage::allocate(size);
+   }
+
+   static void deallocate(void* p, std::size_t size)
+   {
+      --nLive;
+      mcts::HeapStorage::deallocate(p,size);
+   }
+};
+
+long CountingStorage_m::nLive = 0;
+
+const int N_ACTIONS = 8;
+
+typedef mcts::UCTreeNode<N_ACTIONS,mcts::SimpleURand,CountingStorage_m>
+   Tree_m;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Prints one row of results.
+ * @param[in] name name of the copy method.
+ * @param[in] copyTime seconds taken to copy the tree.
+ * @param[in] nCopied number of nodes allocated by the copy.
+ * @param[in] nAfter number of nodes allocated by the copy and its
+ * subsequent iterations.
+ */
+void report
+(
+ const std::string& name,
+ double copyTime,
+ long nCopied,
+ long nAfter
+)
+{
+   std::cout << std::setw(12) << std::left << name << std::right <<
+      std::setw(16) << std::setprecision(4) << 1e6*copyTime <<
+      std::setw(16) << nCopied << std::setw(16) << nAfter <<
+      std::setw(16) << nAfter*sizeof(Tree_m)/1024 << std::endl;
+}
+
+/**
+ * Copies a tree using \c copy, iterates the copy, and reports the cost.
+ */
+template<class CopyFn> void run
+(
+ const std::string& name,
+ const Tree_m& tree,
+ int nIterations,
+ CopyFn copy
+)
+{
+   const long N_START = CountingStorage_m::nLive;
+   Clock::time_point start = Clock::now();
+   Tree_m result = copy(tree);
+   double copyTime = std::chrono::duration<double>(Clock::now()-start).count();
+   const long N_COPIED = CountingStorage_m::nLive - N_START;
+
+   SimpleBandit_m bandit;
+   for(int k=0; k<nIterations; ++k)
+   {
+      result.iterate(bandit);
+   }
+   report(name,copyTime,N_COPIED,CountingStorage_m::nLive-N_START);
+
+} // run
+
+Tree_m deepCopy(const Tree_m& tree)
+{
+   return Tree_m(tree);
+}
+
+Tree_m forkCopy(const Tree_m& tree)
+{
+   return tree.fork();
+}
+
+} // module namespace
+
+/**
+ * Runs the benchmark.
+ */
+int main(int argc, char* argv[])
+{
+   try
+   {
+      int nIterations = 100000;
+      int nForkIterations = 1000;
+      if(1<argc)
+      {
+         nIterations = std::atoi(argv[1]);
+      }
+      if(2<argc)
+      {
+         nForkIterations = std::atoi(argv[2]);
+      }
+
+      Tree_m tree;
+      SimpleBandit_m bandit;
+      for(int k=0; k<nIterations; ++k)
+      {
+         tree.iterate(bandit);
+      }
+      std::cout << "original tree: " << tree.numOfNodes() << " nodes, " <<
+         tree.numOfNodes()*sizeof(Tree_m)/1024 << " KiB, iterations after " <<
+         "copy: " << nForkIterations << std::endl;
+
+      std::cout << std::setw(12) << std::left << "method" << std::right <<
+         std::setw(16) << "copy (us)" << std::setw(16) << "nodes copied" <<
+         std::setw(16) << "nodes after" << std::setw(16) << "KiB after" <<
+         std::endl;
+      run("deep copy",tree,nForkIterations,deepCopy);
+      run("fork",tree,nForkIterations,forkCopy);
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,213 @@
+/**
+ * @file simServer.cpp
+ * Stand-in simulator process for testing and benchmarking
+ * mcts::SimulatorClient. Each step is answered with a reward after a fixed
+ * latency, independently of any other requests outstanding.
+ *
+ * Usage: simServer [latency in ms] [seed] [noise]
+ *
+ * The simulator keeps a separate state for each session, which is a
+ * position on a ring of 4 cells. Each action moves the position forward by
+ * the action's index, and earns a reward of
+ * <tt>noise*u + 0.02*action + 0.01*position</tt>, where \c u is uniformly
+ * distributed in [0,1) and \c position is the new position. Setting the
+ * noise to 0 makes rewards deterministic.
+ *
+ * Requests are read from standard input, one per line, as described for
+ * mcts::SimulatorClient. Replies to steps are written to standard output in
+ * the form <tt>id reward</tt>. The process exits once its input is closed
+ * and all replies have been sent.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Reply waiting to be sent.
+ */
+struct Reply_m
+{
+   Clock::time_point due;
+   long id;
+   double reward;
+
+   bool operator>(const Reply_m& reply) const
+   {
+      return due > reply.due;
+   }
+};
+
+typedef std::priority_queue<Reply_m,std::vector<Reply_m>,
+   std::greater<Reply_m> > ReplyQueue_m;
+
+/**
+ * Number of positions in each session's state.
+ */
+const int N_POSITIONS_M = 4;
+
+/**
+ * Position of each open session.
+ */
+typedef std::map<long,int> Sessions_m;
+
+/**
+ * Performs an action in a session, and returns its reward. Higher actions
+ * are slightly better on average. Sessions that were never opened start
+ * from the initial position.
+ */
+double step(Sessions_m& sessions, long session, int action, double noise)
+{
+   int& position = sessions[session];
+   position = (position + action) % N_POSITIONS_M;
+   return noise*static_cast<double>(rand()%RAND_MAX)/RAND_MAX +
+      0.02*action + 0.01*position;
+}
+
+/**
+ * Parses all whole request lines in \c buf, updates the sessions, and
+ * schedules replies to steps. Unrecognised lines are ignored.
+ */
+void parse
+(
+ std::string& buf,
+ Sessions_m& sessions,
+ ReplyQueue_m& replies,
+ Clock::duration latency,
+ double noise
+)
+{
+   std::size_t start = 0;
+   std::size_t end = 0;
+   while(std::string::npos != (end=buf.find('\n',start)))
+   {
+      const char* line = buf.c_str()+start;
+      long id = 0;
+      long session = 0;
+      long child = 0;
+      int action = 0;
+      if(3==std::sscanf(line,"step %ld %ld %d",&id,&session,&action))
+      {
+         Reply_m reply = { Clock::now()+latency, id,
+            step(sessions,session,action,noise) };
+         replies.push(reply);
+      }
+      else if(2==std::sscanf(line,"fork %ld %ld",&session,&child))
+      {
+         int position = sessions[session];
+         sessions[child] = position;
+      }
+      else if(1==std::sscanf(line,"open %ld",&session))
+      {
+         sessions[session] = 0;
+      }
+      else if(1==std::sscanf(line,"close %ld",&session))
+      {
+         sessions.erase(session);
+      }
+      start = end+1;
+   }
+   buf.erase(0,start);
+}
+
+} // module namespace
+
+/**
+ * Runs the simulator.
+ */
+int main(int argc, char* argv[])
+{
+   double latencyMs = 1.0;
+   if(1<argc)
+   {
+      latencyMs = std::atof(argv[1]);
+   }
+   if(2<argc)
+   {
+      std::srand(std::atoi(argv[2]));
+   }
+   double noise = 0.8;
+   if(3<argc)
+   {
+      noise = std::atof(argv[3]);
+   }
+   const Clock::duration LATENCY = std::chrono::duration_cast
+      <Clock::duration>(std::chrono::duration<double,std::milli>(latencyMs));
+
+   Sessions_m sessions;
+   ReplyQueue_m replies;
+   std::string inBuf;
+   bool isOpen = true;
+   while(isOpen || !replies.empty())
+   {
+      //************************************************************************
+      // Send every reply that is due.
+      //************************************************************************
+      bool sent = false;
+      while(!replies.empty() && replies.top().due <= Clock::now())
+      {
+         std::printf("%ld %.17g\n",replies.top().id,replies.top().reward);
+         replies.pop();
+         sent = true;
+      }
+      if(sent)
+      {
+         std::fflush(stdout);
+      }
+
+      //************************************************************************
+      // Wait for more requests, or until the next reply is due.
+      //************************************************************************
+      timespec timeout = { 0, 0 };
+      timespec* pTimeout = 0;
+      if(!replies.empty())
+      {
+         long wait = std::chrono::duration_cast<std::chrono::nanoseconds>
+            (replies.top().due - Clock::now()).count();
+         wait = 0>wait ? 0 : wait;
+         timeout.tv_sec = wait/1000000000L;
+         timeout.tv_nsec = wait%1000000000L;
+         pTimeout = &timeout;
+      }
+      if(!isOpen)
+      {
+         nanosleep(&timeout,0);
+         continue;
+      }
+      pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+      if(0 >= ppoll(&fd,1,pTimeout,0))
+      {
+         continue;
+      }
+
+      //************************************************************************
+      // Read and schedule new requests.
+      //************************************************************************
+      char buf[4096];
+      ssize_t n = read(STDIN_FILENO,buf,sizeof(buf));
+      if(0>=n)
+      {
+         isOpen = false;
+         continue;
+      }
+      inBuf.append(buf,n);
+      parse(inBuf,sessions,replies,LATENCY,noise);
+   }
+
+   return EXIT_SUCCESS;
+}
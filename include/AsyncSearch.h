@@ -0,0 +1,92 @@
+/**
+ * @file AsyncSearch.h
+ * This file defines the mcts::searchAsync function, which runs many
+ * asynchronous MCTS iterations concurrently on a single thread. This requires
+ * C++20 coroutine support.
+ */
+#ifndef MCTS_ASYNCSEARCH_H
+#define MCTS_ASYNCSEARCH_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+#include "TreeNode.h"
+#include "AsyncTask.h"
+
+#if defined(__cpp_impl_coroutine)
+
+namespace mcts {
+
+/**
+ * Performs a number of MCTS iterations on a tree, keeping up to
+ * \c maxInFlight of them in progress at once, and returning when they have
+ * all completed.
+ *
+ * Each iteration is started with UCTreeNode::iterateAsync. Whenever every
+ * iteration in flight is waiting on the generator, \c loop.poll() is called
+ * to wait for, and resume, at least one of them.
+ * @param[in] tree the root of the tree to search.
+ * @param[in] mdp generator passed to each iteration.
+ * @param[in] loop event loop, such as mcts::SimulatorClient, whose
+ * \c poll() member resumes iterations as their awaited results arrive.
+ * @param[in] nIterations total number of iterations to perform.
+ * @param[in] maxInFlight maximum number of iterations in progress at once.
+ * @param[in] rolloutSteps number of rollout steps per iteration.
+ * @throws any exception thrown by an iteration. In this case, iterations
+ * still waiting on \c loop are destroyed, so \c loop must not be polled
+ * again. The virtual loss of the failed and destroyed iterations is removed
+ * from the tree, so the tree remains usable.
+ */
+template<class Tree, class Generator, class EventLoop> void searchAsync
+(
+ Tree& tree,
+ Generator mdp,
+ EventLoop& loop,
+ int nIterations,
+ int maxInFlight,
+ int rolloutSteps=MAX_ROLLOUT_ITERATIONS
+)
+{
+   std::vector<AsyncTask> tasks;
+   tasks.reserve(maxInFlight);
+   int nStarted = 0;
+   while(nStarted<nIterations || !tasks.empty())
+   {
+      //************************************************************************
+      // Top up the number of iterations in flight.
+      //************************************************************************
+      while(nStarted<nIterations && static_cast<int>(tasks.size())<maxInFlight)
+      {
+         tasks.push_back(tree.iterateAsync(mdp,rolloutSteps));
+         tasks.back().start();
+         ++nStarted;
+      }
+
+      //************************************************************************
+      // Wait for results, which resumes the iterations waiting on them.
+      //************************************************************************
+      loop.poll();
+
+      //************************************************************************
+      // Remove any iterations that have now completed.
+      //************************************************************************
+      for(std::size_t k=0; k<tasks.size(); )
+      {
+         if(!tasks[k].done())
+         {
+            ++k;
+            continue;
+         }
+         tasks[k].rethrowIfFailed();
+         std::swap(tasks[k],tasks.back());
+         tasks.pop_back();
+      }
+   }
+
+} // searchAsync
+
+} // namespace mcts
+
+#endif // __cpp_impl_coroutine
+
+#endif // MCTS_ASYNCSEARCH_H
@@ -0,0 +1,137 @@
+/**
+ * @file AsyncTask.h
+ * This file defines the mcts::AsyncTask class, the coroutine type returned by
+ * UCTreeNode::iterateAsync. This requires C++20 coroutine support.
+ */
+#ifndef MCTS_ASYNCTASK_H
+#define MCTS_ASYNCTASK_H
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace mcts {
+
+/**
+ * Handle to a coroutine which produces no value, such as a single
+ * asynchronous MCTS iteration.
+ *
+ * The coroutine does not start running until AsyncTask::start() is called.
+ * It then runs until its first suspension point, and is resumed by whatever
+ * it is waiting on (typically an mcts::SimulatorClient) until it completes.
+ * The coroutine frame is destroyed when the task is destroyed, so a task
+ * must not be destroyed while its coroutine is suspended, unless the
+ * coroutine will never be resumed.
+ */
+class AsyncTask
+{
+public:
+
+   /**
+    * Promise type required by the coroutine machinery.
+    */
+   struct promise_type
+   {
+      /**
+       * Exception thrown by the coroutine, if any.
+       */
+      std::exception_ptr error;
+
+      AsyncTask get_return_object()
+      {
+         return AsyncTask
+            (std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend() noexcept
+      {
+         return std::suspend_always();
+      }
+
+      std::suspend_always final_suspend() noexcept
+      {
+         return std::suspend_always();
+      }
+
+      void return_void() {}
+
+      void unhandled_exception()
+      {
+         error = std::current_exception();
+      }
+   };
+
+private:
+
+   /**
+    * Handle to the coroutine, or null if this task has been moved from.
+    */
+   std::coroutine_handle<promise_type> handle_i;
+
+   explicit AsyncTask(std::coroutine_handle<promise_type> handle)
+      : handle_i(handle)
+   {}
+
+public:
+
+   AsyncTask(AsyncTask&& task) : handle_i(task.handle_i)
+   {
+      task.handle_i = 0;
+   }
+
+   AsyncTask& operator=(AsyncTask&& task)
+   {
+      std::swap(handle_i,task.handle_i);
+      return *this;
+   }
+
+   AsyncTask(const AsyncTask&) = delete;
+   AsyncTask& operator=(const AsyncTask&) = delete;
+
+   /**
+    * Runs the coroutine until its first suspension point.
+    */
+   void start()
+   {
+      handle_i.resume();
+   }
+
+   /**
+    * Returns true iff the coroutine has completed.
+    */
+   bool done() const
+   {
+      return handle_i.done();
+   }
+
+   /**
+    * Rethrows any exception thrown by the completed coroutine.
+    */
+   void rethrowIfFailed() const
+   {
+      if(handle_i.promise().error)
+      {
+         std::rethrow_exception(handle_i.promise().error);
+      }
+   }
+
+   /**
+    * Destroys the coroutine frame.
+    */
+   ~AsyncTask()
+   {
+      if(handle_i)
+      {
+         handle_i.destroy();
+      }
+   }
+
+}; // class AsyncTask
+
+} // namespace mcts
+
+#endif // __cpp_impl_coroutine
+
+#endif // MCTS_ASYNCTASK_H
@@ -0,0 +1,499 @@
+/**
+ * @file LeafEvalQueue.h
+ * This file defines the mcts::LeafEvalQueue class, which evaluates leaf
+ * nodes in batches on behalf of one or more search threads.
+ */
+#ifndef MCTS_LEAFEVALQUEUE_H
+#define MCTS_LEAFEVALQUEUE_H
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "TreeNode.h"
+
+namespace mcts {
+
+/**
+ * Default maximum number of leaves evaluated in a single batch.
+ */
+const int DEFAULT_EVAL_BATCH_SIZE = 64;
+
+/**
+ * Default time in seconds that a leaf may wait in a mcts::LeafEvalQueue
+ * before a partial batch is flushed.
+ */
+const double DEFAULT_EVAL_TIMEOUT = 0.001;
+
+/**
+ * Statistics reported by mcts::LeafEvalQueue.
+ */
+struct EvalQueueStats
+{
+   /**
+    * Number of batches passed to the evaluator.
+    */
+   long nBatches;
+
+   /**
+    * Total number of leaves passed to the evaluator.
+    */
+   long nLeaves;
+
+   /**
+    * Maximum number of leaves per batch.
+    */
+   int maxBatchSize;
+
+   /**
+    * Sum of all queue latencies in seconds, measured from the time each leaf
+    * was submitted to the time its value was backed up.
+    */
+   double totLatency;
+
+   /**
+    * Largest queue latency observed in seconds.
+    */
+   double maxLatency;
+
+   /**
+    * Constructs an empty set of statistics.
+    */
+   EvalQueueStats(int inMaxBatchSize=DEFAULT_EVAL_BATCH_SIZE)
+      : nBatches(0), nLeaves(0), maxBatchSize(inMaxBatchSize),
+        totLatency(0), maxLatency(0)
+   {}
+
+   /**
+    * Returns the average fraction of each batch that was filled, in the
+    * range [0,1].
+    */
+   double fillRate() const
+   {
+      if(0==nBatches)
+      {
+         return 0.0;
+      }
+      return static_cast<double>(nLeaves) / (nBatches*maxBatchSize);
+   }
+
+   /**
+    * Returns the mean queue latency per leaf in seconds.
+    */
+   double meanLatency() const
+   {
+      if(0==nLeaves)
+      {
+         return 0.0;
+      }
+      return totLatency / nLeaves;
+   }
+
+}; // struct EvalQueueStats
+
+/**
+ * Queue which collects leaf states submitted by UCTreeNode::iterate and
+ * passes them to a value model in batches.
+ *
+ * A batch is flushed as soon as it is full, or once its oldest leaf has
+ * waited longer than the queue's timeout. The value of each leaf is then
+ * passed back to the callback with which it was submitted, while holding
+ * the lock returned by LeafEvalQueue::treeMutex().
+ *
+ * In asynchronous mode, batches are evaluated by a dedicated worker thread,
+ * so that search threads never block on the model. In synchronous mode,
+ * a batch is evaluated on whichever search thread fills it (or finds that it
+ * has timed out), which is useful for deterministic single threaded search.
+ * In either case, LeafEvalQueue::drain() should be called to back up any
+ * remaining leaves before the search results are used.
+ *
+ * Batches may be evaluated by several threads, for example by the worker
+ * and a thread calling LeafEvalQueue::drain(), or by several synchronous
+ * search threads. Calls to the model are serialised by the queue, so the
+ * model itself need not be thread safe.
+ *
+ * @tparam State the type of state submitted for evaluation. When used with
+ * UCTreeNode::iterate, this is the Generator type.
+ * @tparam Model Functor type which provides
+ * <tt>void operator()(const std::vector<State>&, std::vector<double>&)</tt>,
+ * filling the second argument with one value per state in the first.
+ */
+template<class State, class Model> class LeafEvalQueue
+{
+public:
+
+   /**
+    * Type of function called with the value of each leaf.
+    */
+   typedef std::function<void(double)> Callback;
+
+private:
+
+   typedef std::chrono::steady_clock Clock;
+
+   /**
+    * A leaf waiting for evaluation.
+    */
+   struct Entry
+   {
+      State state;
+      Callback callback;
+      Clock::time_point submitted;
+   };
+
+   /**
+    * Model used to evaluate leaves.
+    */
+   Model model_i;
+
+   /**
+    * Maximum number of leaves passed to the model in one batch.
+    */
+   int maxBatch_i;
+
+   /**
+    * Maximum time a leaf should wait before its batch is flushed.
+    */
+   Clock::duration timeout_i;
+
+   /**
+    * Virtual loss applied to the path of each pending leaf.
+    */
+   double virtualLoss_i;
+
+   /**
+    * Lock protecting the search tree. This is held while values are backed
+    * up, and must be held by search threads when accessing the tree.
+    */
+   std::mutex treeMutex_i;
+
+   /**
+    * Lock held while calling the model, so that it is never called by more
+    * than one thread at a time.
+    */
+   std::mutex modelMutex_i;
+
+   /**
+    * Lock protecting all of the following members.
+    */
+   std::mutex queueMutex_i;
+
+   /**
+    * Signalled when leaves are submitted, or the queue is stopped.
+    */
+   std::condition_variable submitted_i;
+
+   /**
+    * Signalled whenever a batch has been backed up.
+    */
+   std::condition_variable completed_i;
+
+   /**
+    * Leaves waiting to be evaluated.
+    */
+   std::deque<Entry> pending_i;
+
+   /**
+    * Number of leaves taken from the queue, but not yet backed up.
+    */
+   int nInFlight_i;
+
+   /**
+    * True iff the worker thread should exit.
+    */
+   bool stopping_i;
+
+   /**
+    * Statistics for all batches backed up so far.
+    */
+   EvalQueueStats stats_i;
+
+   /**
+    * Worker thread used in asynchronous mode.
+    */
+   std::thread worker_i;
+
+   /**
+    * Returns true iff the pending leaves should be flushed now.
+    * @pre queueMutex_i must be held by the caller.
+    */
+   bool ready() const
+   {
+      if(pending_i.empty())
+      {
+         return false;
+      }
+      return static_cast<int>(pending_i.size()) >= maxBatch_i ||
+         Clock::now() - pending_i.front().submitted >= timeout_i;
+   }
+
+   /**
+    * Removes up to one batch of leaves from the queue.
+    * @pre queueMutex_i must be held by the caller.
+    */
+   void takeBatch(std::vector<Entry>& batch)
+   {
+      batch.clear();
+      while(!pending_i.empty() && static_cast<int>(batch.size())<maxBatch_i)
+      {
+         batch.push_back(pending_i.front());
+         pending_i.pop_front();
+      }
+      nInFlight_i += batch.size();
+   }
+
+   /**
+    * Evaluates a batch of leaves, and backs up their values.
+    * @pre queueMutex_i must not be held by the caller.
+    */
+   void evaluate(const std::vector<Entry>& batch)
+   {
+      //***********************************************************************
+      // Pass the batch to the model without holding the tree or queue locks,
+      // since this is (presumably) the expensive part.
+      //***********************************************************************
+      std::vector<State> states;
+      states.reserve(batch.size());
+      for(std::size_t k=0; k<batch.size(); ++k)
+      {
+         states.push_back(batch[k].state);
+      }
+      std::vector<double> values(batch.size(),0.0);
+      {
+         std::lock_guard<std::mutex> lock(modelMutex_i);
+         model_i(states,values);
+      }
+      assert(values.size()==batch.size());
+
+      //***********************************************************************
+      // Back up each value while holding the tree lock.
+      //***********************************************************************
+      {
+         std::lock_guard<std::mutex> lock(treeMutex_i);
+         for(std::size_t k=0; k<batch.size(); ++k)
+         {
+            batch[k].callback(values[k]);
+         }
+      }
+
+      //***********************************************************************
+      // Record statistics, and wake anyone waiting for the queue to drain.
+      //***********************************************************************
+      Clock::time_point now = Clock::now();
+      std::lock_guard<std::mutex> lock(queueMutex_i);
+      stats_i.nBatches++;
+      stats_i.nLeaves += batch.size();
+      for(std::size_t k=0; k<batch.size(); ++k)
+      {
+         double latency = std::chrono::duration<double>
+            (now - batch[k].submitted).count();
+         stats_i.totLatency += latency;
+         if(stats_i.maxLatency < latency)
+         {
+            stats_i.maxLatency = latency;
+         }
+      }
+      nInFlight_i -= batch.size();
+      completed_i.notify_all();
+
+   } // evaluate
+
+   /**
+    * Main loop for the worker thread in asynchronous mode.
+    */
+   void run()
+   {
+      std::vector<Entry> batch;
+      std::unique_lock<std::mutex> lock(queueMutex_i);
+      while(!stopping_i || !pending_i.empty())
+      {
+         //********************************************************************
+         // Wait until a batch is full, or the oldest leaf times out.
+         //********************************************************************
+         if(!stopping_i && !ready())
+         {
+            if(pending_i.empty())
+            {
+               submitted_i.wait(lock);
+            }
+            else
+            {
+               submitted_i.wait_until(lock,
+                  pending_i.front().submitted + timeout_i);
+            }
+            continue;
+         }
+
+         //********************************************************************
+         // Evaluate the batch without holding the queue lock.
+         //********************************************************************
+         takeBatch(batch);
+         lock.unlock();
+         evaluate(batch);
+         lock.lock();
+      }
+
+   } // run
+
+public:
+
+   /**
+    * Constructs a new queue.
+    * @param[in] model the model used to evaluate leaves.
+    * @param[in] maxBatchSize the maximum number of leaves per batch.
+    * @param[in] timeout maximum time in seconds that a leaf should wait
+    * before a partial batch is flushed.
+    * @param[in] async if true, batches are evaluated by a worker thread,
+    * otherwise they are evaluated by the thread which submits the leaf that
+    * fills or times out the batch.
+    * @param[in] virtualLoss virtual loss applied to the path of each leaf
+    * while it is pending.
+    */
+   LeafEvalQueue
+   (
+    Model model=Model(),
+    int maxBatchSize=DEFAULT_EVAL_BATCH_SIZE,
+    double timeout=DEFAULT_EVAL_TIMEOUT,
+    bool async=true,
+    double virtualLoss=DEFAULT_VIRTUAL_LOSS
+   )
+      : model_i(model), maxBatch_i(maxBatchSize),
+        timeout_i(std::chrono::duration_cast<Clock::duration>
+           (std::chrono::duration<double>(timeout))),
+        virtualLoss_i(virtualLoss), nInFlight_i(0), stopping_i(false),
+        stats_i(maxBatchSize)
+   {
+      assert(0<maxBatch_i);
+      if(async)
+      {
+         worker_i = std::thread(&LeafEvalQueue::run,this);
+      }
+   }
+
+   /**
+    * Returns the lock protecting the search tree.
+    */
+   std::mutex& treeMutex()
+   {
+      return treeMutex_i;
+   }
+
+   /**
+    * Returns the virtual loss applied to the path of each pending leaf.
+    */
+   double virtualLoss() const
+   {
+      return virtualLoss_i;
+   }
+
+   /**
+    * Parks a leaf until its batch is flushed.
+    * @param[in] state the state to evaluate.
+    * @param[in] callback called, while holding LeafEvalQueue::treeMutex(),
+    * with the value of \c state once it has been evaluated.
+    * @pre LeafEvalQueue::treeMutex() must not be held by the caller.
+    */
+   void submit(const State& state, Callback callback)
+   {
+      Entry entry = { state, callback, Clock::now() };
+      std::vector<Entry> batch;
+      {
+         std::lock_guard<std::mutex> lock(queueMutex_i);
+         pending_i.push_back(entry);
+
+         //********************************************************************
+         // In asynchronous mode, wake the worker if the batch is ready, or
+         // if this is the first pending leaf, so that the worker can wait
+         // for it to time out.
+         //********************************************************************
+         if(worker_i.joinable())
+         {
+            if(1==pending_i.size() || ready())
+            {
+               submitted_i.notify_one();
+            }
+            return;
+         }
+
+         //********************************************************************
+         // Otherwise, evaluate the batch on this thread if it's ready.
+         //********************************************************************
+         if(!ready())
+         {
+            return;
+         }
+         takeBatch(batch);
+      }
+      evaluate(batch);
+
+   } // submit
+
+   /**
+    * Flushes all pending leaves, and blocks until every leaf submitted so far
+    * has been backed up.
+    * @pre LeafEvalQueue::treeMutex() must not be held by the caller.
+    */
+   void drain()
+   {
+      std::vector<Entry> batch;
+      std::unique_lock<std::mutex> lock(queueMutex_i);
+      while(!pending_i.empty() || 0<nInFlight_i)
+      {
+         if(pending_i.empty())
+         {
+            completed_i.wait(lock);
+            continue;
+         }
+         takeBatch(batch);
+         lock.unlock();
+         evaluate(batch);
+         lock.lock();
+      }
+
+   } // drain
+
+   /**
+    * Returns the number of leaves waiting to be evaluated, or currently
+    * being evaluated.
+    */
+   int numPending()
+   {
+      std::lock_guard<std::mutex> lock(queueMutex_i);
+      return pending_i.size() + nInFlight_i;
+   }
+
+   /**
+    * Returns a copy of the statistics gathered so far.
+    */
+   EvalQueueStats stats()
+   {
+      std::lock_guard<std::mutex> lock(queueMutex_i);
+      return stats_i;
+   }
+
+   /**
+    * Destructor backs up any remaining leaves, and stops the worker thread.
+    */
+   ~LeafEvalQueue()
+   {
+      drain();
+      if(worker_i.joinable())
+      {
+         {
+            std::lock_guard<std::mutex> lock(queueMutex_i);
+            stopping_i = true;
+         }
+         submitted_i.notify_all();
+         worker_i.join();
+      }
+   }
+
+}; // class LeafEvalQueue
+
+} // namespace mcts
+
+#endif // MCTS_LEAFEVALQUEUE_H
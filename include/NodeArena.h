@@ -0,0 +1,805 @@
+/**
+ * @file NodeArena.h
+ * This file defines the mcts::NodeArena and mcts::ArenaPool classes, and the
+ * mcts::ArenaStorage storage policy, which allocate tree nodes from large,
+ * optionally NUMA local and huge page backed, chunks of memory.
+ */
+#ifndef MCTS_NODEARENA_H
+#define MCTS_NODEARENA_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace mcts {
+
+/**
+ * Default size in bytes of each chunk of memory obtained by a NodeArena.
+ * This matches the size of a huge page on most x86-64 and ARM64 systems.
+ */
+const std::size_t DEFAULT_ARENA_CHUNK_SIZE = std::size_t(2) << 20;
+
+/**
+ * Largest block that is served from an arena. Larger requests are passed
+ * straight to the free store.
+ */
+const std::size_t MAX_ARENA_BLOCK_SIZE = std::size_t(64) << 10;
+
+/**
+ * Alignment and size granularity of blocks served from an arena.
+ */
+const std::size_t ARENA_ALIGNMENT = 16;
+
+/**
+ * Type of pages used to back arena chunks.
+ */
+enum PageMode
+{
+   NORMAL_PAGES,           ///< ordinary pages
+   TRANSPARENT_HUGE_PAGES, ///< ordinary pages, advised for huge page merging
+   EXPLICIT_HUGE_PAGES     ///< reserved huge pages, falling back to normal
+};
+
+/**
+ * Determines which threads share an arena.
+ *
+ * With ARENA_PER_THREAD, arenas are not retired or recycled when their
+ * thread exits. Each exited thread's arena, including any chunks still
+ * holding live nodes, is kept until its mcts::ArenaPool is destroyed, so
+ * programs which allocate from many short lived threads should prefer
+ * ARENA_PER_NUMA_NODE, or a thread pool.
+ */
+enum ArenaScope
+{
+   ARENA_PER_THREAD,   ///< each thread allocates from its own arena
+   ARENA_PER_NUMA_NODE ///< threads on the same NUMA node share an arena
+};
+
+/**
+ * Options used to configure an mcts::ArenaPool.
+ */
+struct ArenaOptions
+{
+   /**
+    * Determines which threads share an arena.
+    */
+   ArenaScope scope;
+
+   /**
+    * Type of pages used to back arena chunks.
+    */
+   PageMode pages;
+
+   /**
+    * If true, each chunk is bound to the NUMA node of the thread that
+    * allocates it. This is ignored on single node machines, and on platforms
+    * without NUMA support.
+    */
+   bool numaLocal;
+
+   /**
+    * Size in bytes of each chunk. This must be a power of 2, and larger than
+    * mcts::MAX_ARENA_BLOCK_SIZE. Explicit huge pages are only used if this
+    * is a multiple of the huge page size.
+    */
+   std::size_t chunkSize;
+
+   /**
+    * Constructs the default options: per-thread, NUMA local arenas
+    * backed by transparent huge pages.
+    */
+   ArenaOptions
+   (
+    ArenaScope inScope=ARENA_PER_THREAD,
+    PageMode inPages=TRANSPARENT_HUGE_PAGES,
+    bool inNumaLocal=true,
+    std::size_t inChunkSize=DEFAULT_ARENA_CHUNK_SIZE
+   )
+      : scope(inScope), pages(inPages), numaLocal(inNumaLocal),
+        chunkSize(inChunkSize)
+   {}
+
+}; // struct ArenaOptions
+
+/**
+ * Statistics reported by mcts::ArenaPool.
+ */
+struct ArenaStats
+{
+   /**
+    * Number of arenas created.
+    */
+   int nArenas;
+
+   /**
+    * Number of chunks currently mapped.
+    */
+   long nChunks;
+
+   /**
+    * Number of those chunks backed by explicit huge pages.
+    */
+   long nHugeChunks;
+
+   /**
+    * Number of those chunks successfully bound to a NUMA node.
+    */
+   long nBoundChunks;
+
+   /**
+    * Number of NUMA nodes detected on this machine.
+    */
+   int nNumaNodes;
+
+   ArenaStats()
+      : nArenas(0), nChunks(0), nHugeChunks(0), nBoundChunks(0),
+        nNumaNodes(1)
+   {}
+
+}; // struct ArenaStats
+
+/**
+ * Functions for querying and binding memory to NUMA nodes. These degrade to
+ * a single node on platforms, or machines, without NUMA support.
+ */
+namespace numa {
+
+/**
+ * Returns the number of NUMA nodes on this machine.
+ */
+inline int numOfNodes()
+{
+#if defined(__linux__)
+   static const int N_NODES = []()
+   {
+      int nNodes = 0;
+      DIR* dir = opendir("/sys/devices/system/node");
+      if(0==dir)
+      {
+         return 1;
+      }
+      while(dirent* entry = readdir(dir))
+      {
+         const char* name = entry->d_name;
+         if(0==std::strncmp(name,"node",4) && '0'<=name[4] && '9'>=name[4])
+         {
+            ++nNodes;
+         }
+      }
+      closedir(dir);
+      return 0<nNodes ? nNodes : 1;
+   }();
+   return N_NODES;
+#else
+   return 1;
+#endif
+}
+
+/**
+ * Returns the NUMA node of the CPU on which the calling thread is running.
+ */
+inline int currentNode()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+   unsigned cpu = 0;
+   unsigned node = 0;
+   if(0==syscall(SYS_getcpu,&cpu,&node,0))
+   {
+      return node;
+   }
+#endif
+   return 0;
+}
+
+/**
+ * Asks the kernel to place a range of memory on a given NUMA node. Since
+ * this uses the preferred policy, allocation still succeeds if the node runs
+ * out of memory.
+ * @returns true iff the request was accepted.
+ */
+inline bool bindToNode(void* p, std::size_t size, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+   const int MPOL_PREFERRED_MODE = 1;
+   const unsigned long N_BITS = 8*sizeof(unsigned long);
+   if(0>node || static_cast<unsigned long>(node)>=N_BITS)
+   {
+      return false;
+   }
+   unsigned long mask = 1UL << node;
+   return 0==syscall(SYS_mbind,p,size,MPOL_PREFERRED_MODE,&mask,N_BITS+1,0);
+#else
+   return false;
+#endif
+}
+
+} // namespace numa
+
+/**
+ * Returns the default size in bytes of explicit huge pages on this machine,
+ * or 0 if this is unknown.
+ */
+inline std::size_t hugePageSize()
+{
+#if defined(__linux__)
+   static const std::size_t HUGE_PAGE_SIZE = []()
+   {
+      std::size_t size = 0;
+      std::FILE* file = std::fopen("/proc/meminfo","r");
+      if(0==file)
+      {
+         return size;
+      }
+      char line[256];
+      unsigned long kb = 0;
+      while(0!=std::fgets(line,sizeof(line),file))
+      {
+         if(1==std::sscanf(line,"Hugepagesize: %lu kB",&kb))
+         {
+            size = std::size_t(kb) << 10;
+            break;
+         }
+      }
+      std::fclose(file);
+      return size;
+   }();
+   return HUGE_PAGE_SIZE;
+#else
+   return 0;
+#endif
+}
+
+class ArenaPool;
+
+/**
+ * Allocator which serves small blocks from a list of large, aligned chunks.
+ *
+ * Blocks are carved from the current chunk by bumping a pointer, so that
+ * nodes expanded one after another by the same thread end up next to each
+ * other in memory. Released blocks are kept on per-size free lists and
+ * reused by later allocations of the same size. Chunks are only returned to
+ * the system when the arena is destroyed.
+ *
+ * Each chunk is aligned to its own size, and begins with a header pointing
+ * back to its arena, so that a block can be returned to the arena it came
+ * from regardless of which thread releases it.
+ */
+class NodeArena
+{
+private:
+
+   friend class ArenaPool;
+
+   /**
+    * Header at the start of each chunk.
+    */
+   struct ChunkHeader
+   {
+      NodeArena* owner;
+   };
+
+   /**
+    * Free list node, stored in place of a released block.
+    */
+   struct FreeBlock
+   {
+      FreeBlock* next;
+   };
+
+   /**
+    * Options shared with the pool which owns this arena.
+    */
+   ArenaOptions options_i;
+
+   /**
+    * NUMA node to which this arena's chunks are bound, or -1 if unbound.
+    */
+   int node_i;
+
+   /**
+    * Lock protecting all members below. This is uncontended for per-thread
+    * arenas, except when blocks are released by another thread.
+    */
+   std::mutex mutex_i;
+
+   /**
+    * Start address of each mapped chunk, and whether it uses huge pages.
+    */
+   std::vector<std::pair<char*,bool> > chunks_i;
+
+   /**
+    * Next free byte in the current chunk.
+    */
+   char* next_i;
+
+   /**
+    * End of the current chunk.
+    */
+   char* end_i;
+
+   /**
+    * Free lists, indexed by size in units of mcts::ARENA_ALIGNMENT.
+    */
+   std::vector<FreeBlock*> freeLists_i;
+
+   /**
+    * Number of chunks bound to a NUMA node.
+    */
+   long nBoundChunks_i;
+
+   /**
+    * Maps a new chunk aligned to its own size.
+    * @param[out] isHuge set to true iff the chunk uses explicit huge pages.
+    * @throws std::bad_alloc if no memory is available.
+    */
+   char* mapChunk(bool& isHuge)
+   {
+      const std::size_t size = options_i.chunkSize;
+      isHuge = false;
+#if defined(__linux__)
+      //***********************************************************************
+      // Explicit huge pages are only aligned to the huge page size, so we
+      // only try them if the chunk is a whole number of huge pages, and
+      // keep the mapping only if it happens to be aligned to the chunk size.
+      // NodeArena::owner() relies on that alignment.
+      //***********************************************************************
+      void* p = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+      const std::size_t hugeSize = hugePageSize();
+      if(EXPLICIT_HUGE_PAGES==options_i.pages && 0<hugeSize &&
+         0==size%hugeSize)
+      {
+         p = mmap(0,size,PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+         if(MAP_FAILED!=p && 0!=reinterpret_cast<std::uintptr_t>(p)%size)
+         {
+            munmap(p,size);
+            p = MAP_FAILED;
+         }
+         isHuge = (MAP_FAILED!=p);
+      }
+#endif
+
+      //***********************************************************************
+      // Otherwise, over allocate ordinary pages, and trim to alignment.
+      //***********************************************************************
+      if(MAP_FAILED==p)
+      {
+         p = mmap(0,2*size,PROT_READ|PROT_WRITE,
+                  MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+         if(MAP_FAILED==p)
+         {
+            throw std::bad_alloc();
+         }
+         char* raw = static_cast<char*>(p);
+         std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(raw);
+         char* aligned = raw + ((size - addr%size) % size);
+         if(aligned!=raw)
+         {
+            munmap(raw,aligned-raw);
+         }
+         munmap(aligned+size,raw+2*size-(aligned+size));
+         p = aligned;
+#if defined(MADV_HUGEPAGE)
+         if(NORMAL_PAGES!=options_i.pages)
+         {
+            madvise(p,size,MADV_HUGEPAGE);
+         }
+#endif
+      }
+
+      //***********************************************************************
+      // Bind to the local NUMA node before the pages are first touched.
+      //***********************************************************************
+      if(0<=node_i && numa::bindToNode(p,size,node_i))
+      {
+         ++nBoundChunks_i;
+      }
+      return static_cast<char*>(p);
+#else
+      void* p = std::aligned_alloc(size,size);
+      if(0==p)
+      {
+         throw std::bad_alloc();
+      }
+      return static_cast<char*>(p);
+#endif
+
+   } // mapChunk
+
+   /**
+    * Returns a chunk to the system.
+    * @param[in] p the start of the chunk.
+    * @param[in] isHuge true iff the chunk uses explicit huge pages, in which
+    * case its length is rounded up to a whole number of huge pages.
+    */
+   void unmapChunk(char* p, bool isHuge)
+   {
+#if defined(__linux__)
+      std::size_t size = options_i.chunkSize;
+      const std::size_t hugeSize = hugePageSize();
+      if(isHuge && 0<hugeSize)
+      {
+         size = (size+hugeSize-1)/hugeSize*hugeSize;
+      }
+      munmap(p,size);
+#else
+      std::free(p);
+#endif
+   }
+
+   /**
+    * Maps a new chunk and makes it the current chunk.
+    * @pre mutex_i must be held by the caller.
+    */
+   void addChunk()
+   {
+      bool isHuge = false;
+      char* p = mapChunk(isHuge);
+      chunks_i.push_back(std::make_pair(p,isHuge));
+      reinterpret_cast<ChunkHeader*>(p)->owner = this;
+      next_i = p + ((sizeof(ChunkHeader)+ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT)*
+         ARENA_ALIGNMENT;
+      end_i = p + options_i.chunkSize;
+   }
+
+   /**
+    * Constructs an empty arena.
+    * @param[in] options options shared with the owning pool.
+    * @param[in] node NUMA node to bind to, or -1 for none.
+    */
+   NodeArena(const ArenaOptions& options, int node)
+      : options_i(options), node_i(node), next_i(0), end_i(0),
+        freeLists_i(MAX_ARENA_BLOCK_SIZE/ARENA_ALIGNMENT+1,
+                    static_cast<FreeBlock*>(0)),
+        nBoundChunks_i(0)
+   {
+      assert(0==(options_i.chunkSize&(options_i.chunkSize-1)));
+      assert(MAX_ARENA_BLOCK_SIZE<options_i.chunkSize/2);
+   }
+
+public:
+
+   /**
+    * Returns the arena which owns a block previously allocated from any
+    * arena with the given chunk size.
+    */
+   static NodeArena* owner(void* p, std::size_t chunkSize)
+   {
+      std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(p);
+      return reinterpret_cast<ChunkHeader*>(addr & ~(chunkSize-1))->owner;
+   }
+
+   /**
+    * Allocates a block of memory.
+    * @param[in] size number of bytes, no more than mcts::MAX_ARENA_BLOCK_SIZE.
+    * @throws std::bad_alloc if no memory is available.
+    */
+   void* allocate(std::size_t size)
+   {
+      assert(MAX_ARENA_BLOCK_SIZE>=size);
+      const std::size_t units = (size+ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT;
+      std::lock_guard<std::mutex> lock(mutex_i);
+
+      //***********************************************************************
+      // Reuse a released block of the same size if we have one.
+      //***********************************************************************
+      FreeBlock* pFree = freeLists_i[units];
+      if(0!=pFree)
+      {
+         freeLists_i[units] = pFree->next;
+         return pFree;
+      }
+
+      //***********************************************************************
+      // Otherwise carve a new one from the current chunk.
+      //***********************************************************************
+      const std::size_t bytes = units*ARENA_ALIGNMENT;
+      if(0==next_i || bytes > static_cast<std::size_t>(end_i-next_i))
+      {
+         addChunk();
+      }
+      void* result = next_i;
+      next_i += bytes;
+      return result;
+
+   } // allocate
+
+   /**
+    * Returns a block to this arena's free lists.
+    * @param[in] p the block, which must have been allocated by this arena.
+    * @param[in] size number of bytes originally requested.
+    */
+   void deallocate(void* p, std::size_t size)
+   {
+      const std::size_t units = (size+ARENA_ALIGNMENT-1)/ARENA_ALIGNMENT;
+      std::lock_guard<std::mutex> lock(mutex_i);
+      FreeBlock* pFree = static_cast<FreeBlock*>(p);
+      pFree->next = freeLists_i[units];
+      freeLists_i[units] = pFree;
+   }
+
+   /**
+    * Returns the NUMA node to which this arena is bound, or -1 if unbound.
+    */
+   int node() const
+   {
+      return node_i;
+   }
+
+   /**
+    * Destructor returns all chunks to the system.
+    */
+   ~NodeArena()
+   {
+      for(std::size_t k=0; k<chunks_i.size(); ++k)
+      {
+         unmapChunk(chunks_i[k].first,chunks_i[k].second);
+      }
+   }
+
+}; // class NodeArena
+
+/**
+ * Collection of arenas, one per thread or one per NUMA node, from which each
+ * thread allocates into the arena local to it. Arenas are only released when
+ * the pool is destroyed (see mcts::ArenaScope).
+ */
+class ArenaPool
+{
+private:
+
+   /**
+    * Options used to create arenas.
+    */
+   ArenaOptions options_i;
+
+   /**
+    * Number of NUMA nodes detected.
+    */
+   int nNodes_i;
+
+   /**
+    * Maximum number of pools whose arenas are cached by each thread.
+    */
+   static const std::size_t MAX_CACHED_POOLS = 8;
+
+   /**
+    * Unique identifier used to key thread local caches.
+    */
+   unsigned long id_i;
+
+   /**
+    * Lock protecting the members below.
+    */
+   std::mutex mutex_i;
+
+   /**
+    * All arenas created so far.
+    */
+   std::vector<std::unique_ptr<NodeArena> > arenas_i;
+
+   /**
+    * Arena used by each thread.
+    */
+   std::map<std::thread::id,NodeArena*> byThread_i;
+
+   /**
+    * Arena used by each NUMA node.
+    */
+   std::map<int,NodeArena*> byNode_i;
+
+   /**
+    * Returns a new unique pool identifier.
+    */
+   static unsigned long nextId()
+   {
+      static std::mutex mutex;
+      static unsigned long counter = 0;
+      std::lock_guard<std::mutex> lock(mutex);
+      return ++counter;
+   }
+
+   /**
+    * Finds or creates the arena for the calling thread.
+    */
+   NodeArena* lookup()
+   {
+      const bool isMultiNode = options_i.numaLocal && 1<nNodes_i;
+      const int node = isMultiNode ? numa::currentNode() : -1;
+      std::lock_guard<std::mutex> lock(mutex_i);
+      NodeArena*& pArena = (ARENA_PER_THREAD==options_i.scope) ?
+         byThread_i[std::this_thread::get_id()] : byNode_i[node];
+      if(0==pArena)
+      {
+         arenas_i.push_back(std::unique_ptr<NodeArena>
+            (new NodeArena(options_i,node)));
+         pArena = arenas_i.back().get();
+      }
+      return pArena;
+   }
+
+public:
+
+   /**
+    * Constructs an empty pool.
+    * @param[in] options options used to create arenas.
+    */
+   ArenaPool(const ArenaOptions& options=ArenaOptions())
+      : options_i(options), nNodes_i(numa::numOfNodes()), id_i(nextId())
+   {}
+
+   /**
+    * Returns the options used by this pool.
+    */
+   const ArenaOptions& options() const
+   {
+      return options_i;
+   }
+
+   /**
+    * Returns the arena local to the calling thread. For per-NUMA-node pools,
+    * this is fixed by the node on which the thread first allocates, so
+    * threads should be pinned to a node for best results.
+    */
+   NodeArena& local()
+   {
+      //***********************************************************************
+      // Each thread caches its arena for the last few pools it used, keyed
+      // by pool identifier, so that threads allocating from several pools
+      // don't have to lock the pool on every allocation. Since identifiers
+      // are never reused, entries for destroyed pools can never match.
+      //***********************************************************************
+      typedef std::pair<unsigned long,NodeArena*> Entry;
+      static thread_local std::vector<Entry> cache;
+      for(std::size_t k=0; k<cache.size(); ++k)
+      {
+         if(id_i==cache[k].first)
+         {
+            return *cache[k].second;
+         }
+      }
+
+      //***********************************************************************
+      // On a miss, find the arena in the pool, and replace the oldest entry
+      // if the cache is full.
+      //***********************************************************************
+      if(MAX_CACHED_POOLS<=cache.size())
+      {
+         cache.erase(cache.begin());
+      }
+      cache.push_back(Entry(id_i,lookup()));
+      return *cache.back().second;
+   }
+
+   /**
+    * Allocates a block from the calling thread's local arena.
+    * @param[in] size the number of bytes required.
+    */
+   void* allocate(std::size_t size)
+   {
+      if(MAX_ARENA_BLOCK_SIZE<size)
+      {
+         return ::operator new(size);
+      }
+      return local().allocate(size);
+   }
+
+   /**
+    * Returns a block to the arena it was allocated from.
+    * @param[in] p the block to release.
+    * @param[in] size the number of bytes originally requested.
+    */
+   void deallocate(void* p, std::size_t size)
+   {
+      if(MAX_ARENA_BLOCK_SIZE<size)
+      {
+         ::operator delete(p);
+         return;
+      }
+      NodeArena::owner(p,options_i.chunkSize)->deallocate(p,size);
+   }
+
+   /**
+    * Returns statistics for all arenas in this pool.
+    */
+   ArenaStats stats()
+   {
+      ArenaStats result;
+      result.nNumaNodes = nNodes_i;
+      std::lock_guard<std::mutex> lock(mutex_i);
+      result.nArenas = arenas_i.size();
+      for(std::size_t k=0; k<arenas_i.size(); ++k)
+      {
+         NodeArena& arena = *arenas_i[k];
+         std::lock_guard<std::mutex> arenaLock(arena.mutex_i);
+         result.nChunks += arena.chunks_i.size();
+         result.nBoundChunks += arena.nBoundChunks_i;
+         for(std::size_t c=0; c<arena.chunks_i.size(); ++c)
+         {
+            result.nHugeChunks += arena.chunks_i[c].second ? 1 : 0;
+         }
+      }
+      return result;
+   }
+
+}; // class ArenaPool
+
+/**
+ * Storage policy which allocates tree nodes from a process wide
+ * mcts::ArenaPool. Trees instantiated with different \c Tag types use
+ * different pools, and so can be configured independently.
+ *
+ * ArenaStorage::configure() may be called before the first node is
+ * allocated to change the pool's options. Since arenas keep their memory
+ * until the pool is destroyed at exit, this policy suits long running
+ * searches over large trees, rather than many short lived ones.
+ * @tparam Tag any type, used only to distinguish pools.
+ */
+template<class Tag=void> struct ArenaStorage
+{
+   /**
+    * Returns the pool used by this policy.
+    */
+   static ArenaPool& pool()
+   {
+      return *poolPtr();
+   }
+
+   /**
+    * Replaces the pool used by this policy with one using new options.
+    * @pre no nodes may currently be allocated from the existing pool.
+    */
+   static void configure(const ArenaOptions& options)
+   {
+      poolPtr().reset(new ArenaPool(options));
+   }
+
+   /**
+    * Allocates memory from the calling thread's local arena.
+    * @see HeapStorage::allocate
+    */
+   static void* allocate(std::size_t size)
+   {
+      return pool().allocate(size);
+   }
+
+   /**
+    * Returns memory to the arena it was allocated from.
+    * @see HeapStorage::deallocate
+    */
+   static void deallocate(void* p, std::size_t size)
+   {
+      pool().deallocate(p,size);
+   }
+
+private:
+
+   static std::unique_ptr<ArenaPool>& poolPtr()
+   {
+      static std::unique_ptr<ArenaPool> pPool(new ArenaPool());
+      return pPool;
+   }
+
+}; // struct ArenaStorage
+
+} // namespace mcts
+
+#endif // MCTS_NODEARENA_H
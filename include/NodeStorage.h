@@ -0,0 +1,44 @@
+/**
+ * @file NodeStorage.h
+ * This file defines the storage policies used to allocate tree nodes.
+ */
+#ifndef MCTS_NODESTORAGE_H
+#define MCTS_NODESTORAGE_H
+
+#include <cstddef>
+#include <new>
+
+namespace mcts {
+
+/**
+ * Default storage policy, which allocates tree nodes from the free store.
+ * A storage policy is any type providing the static member functions
+ * below, and is used by tree node types to allocate children.
+ */
+struct HeapStorage
+{
+   /**
+    * Allocates raw memory suitable for any tree node type.
+    * @param[in] size the number of bytes required.
+    * @returns pointer to the allocated memory.
+    */
+   static void* allocate(std::size_t size)
+   {
+      return ::operator new(size);
+   }
+
+   /**
+    * Releases memory previously returned by HeapStorage::allocate.
+    * @param[in] p the memory to release.
+    * @param[in] size the number of bytes originally requested.
+    */
+   static void deallocate(void* p, std::size_t size)
+   {
+      ::operator delete(p);
+   }
+
+}; // struct HeapStorage
+
+} // namespace mcts
+
+#endif // MCTS_NODESTORAGE_H
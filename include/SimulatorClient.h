@@ -0,0 +1,598 @@
+/**
+ * @file SimulatorClient.h
+ * This file defines the mcts::SimulatorClient class, which talks to a
+ * simulator running in a separate process over a local socket, and can be
+ * awaited by asynchronous MCTS iterations. This requires a POSIX platform,
+ * and C++20 coroutine support for asynchronous use.
+ */
+#ifndef MCTS_SIMULATORCLIENT_H
+#define MCTS_SIMULATORCLIENT_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+namespace mcts {
+
+/**
+ * Default time in milliseconds that SimulatorClient::poll() waits for a reply.
+ */
+const int DEFAULT_SIM_POLL_TIMEOUT = 100;
+
+/**
+ * Client for a simulator process which returns a reward for each action.
+ *
+ * The simulator is started as a child process, and keeps a separate state
+ * for each of a number of sessions, identified by the client. It receives
+ * one request per line on its standard input, in one of the forms:
+ * - <tt>open session</tt>: start a new session in the initial state.
+ * - <tt>fork session child</tt>: start a new session, \c child, in a copy of
+ *   the current state of \c session.
+ * - <tt>close session</tt>: discard a session's state.
+ * - <tt>step id session action</tt>: perform \c action in \c session.
+ *
+ * Requests are applied in the order they are received, but the simulator
+ * only replies to steps, on its standard output, with lines of the form
+ * <tt>id reward</tt>. These may arrive in any order, so that many steps may
+ * be outstanding at once.
+ *
+ * Sessions are normally managed by mcts::SimulatorSession, so that copying
+ * a generator forks its simulator state, just as copying an in-process
+ * generator copies its state.
+ *
+ * Requests can either be made synchronously, using SimulatorClient::call(),
+ * or awaited by a coroutine using SimulatorClient::step(), in which case the
+ * coroutine is resumed from within SimulatorClient::poll() when the reply
+ * arrives. A client must only be used by one thread at a time.
+ *
+ * The simulator's standard input and output are both connected to one end
+ * of a socket pair. The client's end is closed on exec, so that simulators
+ * started by other clients don't keep it open, and writes to it never raise
+ * SIGPIPE, so a simulator that exits early is reported as an error rather
+ * than terminating the host process.
+ */
+class SimulatorClient
+{
+private:
+
+   /**
+    * Request waiting for a reply.
+    */
+   struct Pending
+   {
+      /**
+       * Where to store the reward.
+       */
+      double* pResult;
+
+#if defined(__cpp_impl_coroutine)
+      /**
+       * Coroutine to resume, or null if the request is synchronous.
+       */
+      std::coroutine_handle<> handle;
+#endif
+
+      /**
+       * True once the reply has arrived, for synchronous requests.
+       */
+      bool* pDone;
+   };
+
+   /**
+    * Process id of the simulator.
+    */
+   pid_t pid_i;
+
+   /**
+    * Our end of the socket connected to the simulator's standard input and
+    * output.
+    */
+   int sim_i;
+
+   /**
+    * Identifier for the next request.
+    */
+   long nextId_i;
+
+   /**
+    * Identifier for the next session.
+    */
+   long nextSession_i;
+
+   /**
+    * Number of sessions currently open.
+    */
+   int nSessions_i;
+
+   /**
+    * Requests waiting for a reply, by identifier.
+    */
+   std::unordered_map<long,Pending> pending_i;
+
+   /**
+    * Requests not yet written to the simulator.
+    */
+   std::string outBuf_i;
+
+   /**
+    * Partial reply lines read from the simulator.
+    */
+   std::string inBuf_i;
+
+   /**
+    * Queues a step.
+    */
+   void request(long session, int action, const Pending& pending)
+   {
+      const long id = nextId_i++;
+      pending_i[id] = pending;
+      char line[96];
+      std::snprintf(line,sizeof(line),"step %ld %ld %d\n",id,session,action);
+      outBuf_i += line;
+   }
+
+   /**
+    * Writes as much of the output buffer as the socket will accept without
+    * blocking.
+    */
+   void flush()
+   {
+#if defined(MSG_NOSIGNAL)
+      const int FLAGS = MSG_NOSIGNAL;
+#else
+      const int FLAGS = 0; // SIGPIPE is disabled by SO_NOSIGPIPE instead
+#endif
+      while(!outBuf_i.empty())
+      {
+         ssize_t n = ::send(sim_i,outBuf_i.data(),outBuf_i.size(),FLAGS);
+         if(0>n)
+         {
+            if(EAGAIN==errno || EINTR==errno)
+            {
+               return;
+            }
+            throw std::runtime_error("failed to write to simulator");
+         }
+         outBuf_i.erase(0,n);
+      }
+   }
+
+   /**
+    * Reads any available replies, and completes their requests.
+    */
+   void receive()
+   {
+      char buf[4096];
+      ssize_t n = read(sim_i,buf,sizeof(buf));
+      if(0==n)
+      {
+         throw std::runtime_error("simulator exited unexpectedly");
+      }
+      if(0>n)
+      {
+         if(EAGAIN==errno || EINTR==errno)
+         {
+            return;
+         }
+         throw std::runtime_error("failed to read from simulator");
+      }
+      inBuf_i.append(buf,n);
+
+      //***********************************************************************
+      // Complete each whole line received. Resumed coroutines may make new
+      // requests, but these only modify the output buffer and pending map.
+      //***********************************************************************
+      std::size_t start = 0;
+      std::size_t end = 0;
+      std::vector<std::pair<long,double> > replies;
+      while(std::string::npos != (end=inBuf_i.find('\n',start)))
+      {
+         long id = 0;
+         double reward = 0;
+         if(2!=std::sscanf(inBuf_i.c_str()+start,"%ld %lf",&id,&reward))
+         {
+            throw std::runtime_error("malformed reply from simulator");
+         }
+         replies.push_back(std::make_pair(id,reward));
+         start = end+1;
+      }
+      inBuf_i.erase(0,start);
+
+      for(std::size_t k=0; k<replies.size(); ++k)
+      {
+         std::unordered_map<long,Pending>::iterator pos =
+            pending_i.find(replies[k].first);
+         if(pending_i.end()==pos)
+         {
+            throw std::runtime_error("unexpected reply from simulator");
+         }
+         Pending pending = pos->second;
+         pending_i.erase(pos);
+         *pending.pResult = replies[k].second;
+         if(0!=pending.pDone)
+         {
+            *pending.pDone = true;
+         }
+#if defined(__cpp_impl_coroutine)
+         if(pending.handle)
+         {
+            pending.handle.resume();
+         }
+#endif
+      }
+
+   } // receive
+
+public:
+
+   /**
+    * Starts a simulator process.
+    * @param[in] path path to the simulator executable.
+    * @param[in] args arguments passed to the simulator.
+    * @throws std::runtime_error if the process cannot be started.
+    */
+   SimulatorClient
+   (
+    const std::string& path,
+    const std::vector<std::string>& args=std::vector<std::string>()
+   )
+      : pid_i(-1), sim_i(-1), nextId_i(0), nextSession_i(0), nSessions_i(0)
+   {
+      //***********************************************************************
+      // Both ends are created close on exec, so that they are not inherited
+      // by simulators started later by other clients. Otherwise, those
+      // simulators would hold this simulator's input open, and it would
+      // never see end of file.
+      //***********************************************************************
+      int fds[2];
+#if defined(SOCK_CLOEXEC)
+      if(0!=socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,fds))
+      {
+         throw std::runtime_error("failed to create socket");
+      }
+#else
+      if(0!=socketpair(AF_UNIX,SOCK_STREAM,0,fds))
+      {
+         throw std::runtime_error("failed to create socket");
+      }
+      fcntl(fds[0],F_SETFD,FD_CLOEXEC);
+      fcntl(fds[1],F_SETFD,FD_CLOEXEC);
+#endif
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+      int on = 1;
+      setsockopt(fds[0],SOL_SOCKET,SO_NOSIGPIPE,&on,sizeof(on));
+#endif
+
+      //***********************************************************************
+      // Build the argument list before forking, since the child must not
+      // allocate memory.
+      //***********************************************************************
+      std::vector<char*> argv;
+      argv.push_back(const_cast<char*>(path.c_str()));
+      for(std::size_t k=0; k<args.size(); ++k)
+      {
+         argv.push_back(const_cast<char*>(args[k].c_str()));
+      }
+      argv.push_back(0);
+
+      //***********************************************************************
+      // The duplicated descriptors are not close on exec, so the simulator
+      // keeps its standard input and output.
+      //***********************************************************************
+      pid_i = fork();
+      if(0==pid_i)
+      {
+         dup2(fds[1],STDIN_FILENO);
+         dup2(fds[1],STDOUT_FILENO);
+         execv(path.c_str(),&argv[0]);
+         _exit(127);
+      }
+      close(fds[1]);
+      sim_i = fds[0];
+      if(0>pid_i)
+      {
+         close(sim_i);
+         throw std::runtime_error("failed to start simulator");
+      }
+
+      //***********************************************************************
+      // Never block on writes, so that we can't deadlock with a simulator
+      // that is blocked writing replies to us.
+      //***********************************************************************
+      fcntl(sim_i,F_SETFL,fcntl(sim_i,F_GETFL)|O_NONBLOCK);
+
+   } // constructor
+
+   SimulatorClient(const SimulatorClient&) = delete;
+   SimulatorClient& operator=(const SimulatorClient&) = delete;
+
+   /**
+    * Sends any queued requests, waits until at least one reply arrives (or
+    * the timeout expires), and completes all requests whose replies have
+    * arrived, resuming their coroutines.
+    * @param[in] timeout maximum time to wait in milliseconds.
+    * @throws std::runtime_error if communication with the simulator fails.
+    */
+   void poll(int timeout=DEFAULT_SIM_POLL_TIMEOUT)
+   {
+      flush();
+      if(pending_i.empty())
+      {
+         return;
+      }
+      pollfd fd;
+      fd.fd = sim_i;
+      fd.events = outBuf_i.empty() ? POLLIN : POLLIN|POLLOUT;
+      fd.revents = 0;
+      if(0 < ::poll(&fd,1,timeout) && 0!=(fd.revents&~POLLOUT))
+      {
+         receive();
+      }
+      flush();
+   }
+
+   /**
+    * Starts a new session in the simulator's initial state. Like all session
+    * requests, this is sent by the next call to SimulatorClient::poll(), and
+    * does not wait for a reply.
+    * @returns the identifier of the new session.
+    */
+   long openSession()
+   {
+      const long session = nextSession_i++;
+      char line[64];
+      std::snprintf(line,sizeof(line),"open %ld\n",session);
+      outBuf_i += line;
+      ++nSessions_i;
+      return session;
+   }
+
+   /**
+    * Starts a new session in a copy of an existing session's current state,
+    * including all steps requested in it so far.
+    * @returns the identifier of the new session.
+    */
+   long forkSession(long session)
+   {
+      const long child = nextSession_i++;
+      char line[96];
+      std::snprintf(line,sizeof(line),"fork %ld %ld\n",session,child);
+      outBuf_i += line;
+      ++nSessions_i;
+      return child;
+   }
+
+   /**
+    * Discards a session. Replies to steps already requested in it are still
+    * delivered.
+    */
+   void closeSession(long session)
+   {
+      char line[64];
+      std::snprintf(line,sizeof(line),"close %ld\n",session);
+      outBuf_i += line;
+      --nSessions_i;
+   }
+
+   /**
+    * Returns the reward for an action performed in a session, blocking until
+    * it arrives. Other replies received while waiting are also completed.
+    */
+   double call(long session, int action)
+   {
+      double result = 0;
+      bool done = false;
+      Pending pending = { &result };
+      pending.pDone = &done;
+      request(session,action,pending);
+      while(!done)
+      {
+         poll();
+      }
+      return result;
+   }
+
+   /**
+    * Returns the number of requests waiting for replies.
+    */
+   int numPending() const
+   {
+      return pending_i.size();
+   }
+
+   /**
+    * Returns the number of sessions currently open.
+    */
+   int numSessions() const
+   {
+      return nSessions_i;
+   }
+
+#if defined(__cpp_impl_coroutine)
+   /**
+    * Awaitable returned by SimulatorClient::step().
+    */
+   struct StepAwaiter
+   {
+      SimulatorClient* pClient;
+      long session;
+      int action;
+      double result;
+
+      bool await_ready() const
+      {
+         return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> handle)
+      {
+         Pending pending = { &result };
+         pending.handle = handle;
+         pending.pDone = 0;
+         pClient->request(session,action,pending);
+      }
+
+      double await_resume() const
+      {
+         return result;
+      }
+   };
+
+   /**
+    * Returns an awaitable which yields the reward for an action performed in
+    * a session. The request is sent, and the awaiting coroutine resumed, by
+    * a later call to SimulatorClient::poll().
+    */
+   StepAwaiter step(long session, int action)
+   {
+      StepAwaiter awaiter = { this, session, action, 0.0 };
+      return awaiter;
+   }
+#endif
+
+   /**
+    * Closes the simulator's input, and waits for it to exit.
+    */
+   ~SimulatorClient()
+   {
+      close(sim_i);
+      int status = 0;
+      waitpid(pid_i,&status,0);
+   }
+
+}; // class SimulatorClient
+
+/**
+ * Handle to a session of a mcts::SimulatorClient, which is used as the
+ * base of the generators below.
+ *
+ * Copying a session forks the simulator's state, so that a copied
+ * generator continues independently from the state of the original, as
+ * UCTreeNode expects. Sessions are closed when destroyed, so the client
+ * must outlive all of its sessions.
+ */
+class SimulatorSession
+{
+protected:
+
+   /**
+    * The client, or null if this session has been moved from.
+    */
+   SimulatorClient* pClient_i;
+
+   /**
+    * Identifier of this session.
+    */
+   long session_i;
+
+public:
+
+   /**
+    * Opens a new session in the simulator's initial state.
+    */
+   explicit SimulatorSession(SimulatorClient& client)
+      : pClient_i(&client), session_i(client.openSession())
+   {}
+
+   /**
+    * Forks a session, snapshotting its current state.
+    */
+   SimulatorSession(const SimulatorSession& session)
+      : pClient_i(session.pClient_i),
+        session_i(session.pClient_i->forkSession(session.session_i))
+   {}
+
+   /**
+    * Takes over a session without forking it.
+    */
+   SimulatorSession(SimulatorSession&& session)
+      : pClient_i(session.pClient_i), session_i(session.session_i)
+   {
+      session.pClient_i = 0;
+   }
+
+   /**
+    * Replaces this session with a fork, or the moved state, of another.
+    */
+   SimulatorSession& operator=(SimulatorSession session)
+   {
+      std::swap(pClient_i,session.pClient_i);
+      std::swap(session_i,session.session_i);
+      return *this;
+   }
+
+   /**
+    * Closes the session.
+    */
+   ~SimulatorSession()
+   {
+      if(0!=pClient_i)
+      {
+         pClient_i->closeSession(session_i);
+      }
+   }
+
+   /**
+    * Returns the identifier of this session.
+    */
+   long id() const
+   {
+      return session_i;
+   }
+
+}; // class SimulatorSession
+
+/**
+ * Generator which passes each action to its own simulator session,
+ * blocking until the reward arrives.
+ */
+struct BlockingSimGenerator : public SimulatorSession
+{
+   explicit BlockingSimGenerator(SimulatorClient& client)
+      : SimulatorSession(client)
+   {}
+
+   double operator()(int action)
+   {
+      return pClient_i->call(session_i,action);
+   }
+};
+
+#if defined(__cpp_impl_coroutine)
+/**
+ * Generator for UCTreeNode::iterateAsync which awaits each reward from its
+ * own simulator session. Since each iteration works on a copy of the
+ * generator, iterations in flight at the same time each have their own
+ * forked simulator state.
+ */
+struct AsyncSimGenerator : public SimulatorSession
+{
+   explicit AsyncSimGenerator(SimulatorClient& client)
+      : SimulatorSession(client)
+   {}
+
+   SimulatorClient::StepAwaiter step(int action)
+   {
+      return pClient_i->step(session_i,action);
+   }
+};
+#endif
+
+} // namespace mcts
+
+#endif // MCTS_SIMULATORCLIENT_H
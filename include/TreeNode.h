@@ -9,7 +9,14 @@
 #include <cassert>
 #include <limits>
 #include <stack>
+#include <vector>
 #include <iostream>
+#include <mutex>
+#include <atomic>
+#include <utility>
+#include <new>
+#include "NodeStorage.h"
+#include "AsyncTask.h"
 
 /**
  * Namespace for all public functions and types defined in the MCTS library.
@@ -31,6 +38,13 @@ const double MAX_ROLLOUT_ITERATIONS = 50;
  */
 const double DEFAULT_GAMMA = 0.9;
 
+/**
+ * Default virtual loss applied to each node on the path of an iteration whose
+ * leaf value is still pending evaluation. This discourages other iterations
+ * from following the same path until the real value has been backed up.
+ */
+const double DEFAULT_VIRTUAL_LOSS = 1.0;
+
 /**
  * Simple uniform random number generator.
  * This provides a default type for generating random numbers for
@@ -47,22 +61,311 @@ struct SimpleURand
    }
 };
 
+/**
+ * Returns a random number generator private to the calling thread. This is
+ * used for rollouts performed without holding a lock on the tree, so that
+ * concurrent rollouts neither share a generator, nor need to reserve numbers
+ * from a shared one under the lock. Since each thread default constructs
+ * its own instance, URand types with internal state should seed each
+ * instance differently.
+ */
+template<class URand> URand& threadRand()
+{
+   static thread_local URand rand;
+   return rand;
+}
+
+/**
+ * Path of an iteration whose leaf value is waiting to be evaluated by a
+ * queue, such as mcts::LeafEvalQueue. This is shared by mcts::UCTreeNode
+ * and mcts::VarTreeNode, and is submitted to the queue as the leaf's
+ * callback.
+ *
+ * Constructing a pending path gives each node on it a virtual loss, so that
+ * other iterations are steered towards other paths in the meantime. Calling
+ * it with the leaf's value replaces the virtual loss on each node with its
+ * real discounted value.
+ * @tparam Node the tree node type, which must declare this class a friend,
+ * and provide \c addVirtualLoss(loss) and \c revertVirtualLoss(value,loss).
+ */
+template<class Node> class PendingPath
+{
+private:
+
+   /**
+    * The nodes on the path, with the leaf on top.
+    */
+   std::stack<Node*> visited_i;
+
+   /**
+    * The immediate rewards received on entering each node on the path.
+    */
+   std::stack<double> rewards_i;
+
+   /**
+    * Discount factor for future rewards.
+    */
+   double gamma_i;
+
+   /**
+    * The virtual loss applied to each node.
+    */
+   double loss_i;
+
+   /**
+    * Total discounted reward received by any rollout steps after the leaf.
+    */
+   double partial_i;
+
+   /**
+    * Discount applied to the leaf's value.
+    */
+   double discount_i;
+
+public:
+
+   /**
+    * Applies virtual loss to each node on a path.
+    * @param[in] visited the path, with the leaf on top.
+    * @param[in] rewards the rewards received on entering each node.
+    * @param[in] gamma discount factor for future rewards.
+    * @param[in] loss the virtual loss to apply.
+    * @pre the caller must hold the lock protecting the tree.
+    */
+   PendingPath
+   (
+    std::stack<Node*> visited,
+    std::stack<double> rewards,
+    double gamma,
+    double loss
+   )
+      : visited_i(std::move(visited)), rewards_i(std::move(rewards)),
+        gamma_i(gamma), loss_i(loss), partial_i(0.0), discount_i(1.0)
+   {
+      std::stack<Node*> path(visited_i);
+      while(!path.empty())
+      {
+         path.top()->addVirtualLoss(loss_i);
+         path.pop();
+      }
+   }
+
+   /**
+    * Records the result of any rollout steps performed after the leaf.
+    * @param[in] partial the total discounted reward of the rollout.
+    * @param[in] discount the discount to apply to the leaf's value.
+    */
+   void setRollout(double partial, double discount)
+   {
+      partial_i = partial;
+      discount_i = discount;
+   }
+
+   /**
+    * Replaces the virtual loss on each node with its discounted value. This
+    * must be called exactly once.
+    * @param[in] leafValue the value of the state reached at the end of the
+    * path and rollout.
+    * @pre the caller must hold the lock protecting the tree.
+    */
+   void operator()(double leafValue)
+   {
+      double value = partial_i + discount_i*leafValue;
+      while(!visited_i.empty())
+      {
+         value = rewards_i.top() + gamma_i*value;
+         visited_i.top()->revertVirtualLoss(value,loss_i);
+         visited_i.pop();
+         rewards_i.pop();
+      }
+   }
+
+}; // class PendingPath
+
 /**
  * Represents a node in a UCT tree. This provides the main data structure and
  * implementation of the UCT (Upper Confidence Tree) algorithm.
  * @tparam N_ACTIONS the number of actions in the action domain.
  * @tparam URand class used to generate uniform random numbers in range [0,1).
  * This is used internally during selection and rollout.
+ * @tparam Storage storage policy used to allocate child nodes, such as
+ * mcts::HeapStorage or mcts::ArenaStorage.
+ *
+ * Child nodes are reference counted, so that several trees created by
+ * UCTreeNode::fork() can share the same subtrees. A shared node is never
+ * modified in place: any iteration that needs to update it first replaces
+ * it with a private copy (which in turn shares the original's children),
+ * so only nodes along paths that a tree actually modifies are ever copied.
  */
-template<int N_ACTIONS, class URand=SimpleURand> class UCTreeNode
+template
+<
+ int N_ACTIONS,
+ class URand=SimpleURand,
+ class Storage=HeapStorage
+>
+class UCTreeNode
 {
 private: 
 
+   template<class Node> friend class PendingPath;
+
+   /**
+    * Constructs a new node using memory obtained from the storage policy.
+    * @param[in] tree if not null, the new node is a deep copy of this tree,
+    * otherwise it is a new leaf node.
+    */
+   static UCTreeNode* newNode(const UCTreeNode* tree=0)
+   {
+      void* p = Storage::allocate(sizeof(UCTreeNode));
+      if(0==tree)
+      {
+         return new (p) UCTreeNode();
+      }
+      return new (p) UCTreeNode(*tree);
+   }
+
+   /**
+    * Destroys a node constructed by UCTreeNode::newNode, and returns its
+    * memory to the storage policy.
+    */
+   static void deleteNode(UCTreeNode* node)
+   {
+      node->~UCTreeNode();
+      Storage::deallocate(node,sizeof(UCTreeNode));
+   }
+
+   /**
+    * Adds a reference to a shared node.
+    */
+   static void acquireNode(UCTreeNode* node)
+   {
+      node->refCount_i.fetch_add(1,std::memory_order_relaxed);
+   }
+
+   /**
+    * Removes a reference to a shared node, destroying it if there are no
+    * references left.
+    * @returns true iff the node was destroyed.
+    */
+   static bool releaseNode(UCTreeNode* node)
+   {
+      if(1==node->refCount_i.fetch_sub(1,std::memory_order_acq_rel))
+      {
+         deleteNode(node);
+         return true;
+      }
+      return false;
+   }
+
+   /**
+    * Makes this node share all of another node's children.
+    * @pre this node must have no children.
+    */
+   void shareChildren(const UCTreeNode& tree)
+   {
+      isLeaf_i = tree.isLeaf_i;
+      if(isLeaf_i)
+      {
+         return;
+      }
+      for(int k=0; k<N_ACTIONS; ++k)
+      {
+         assert(0==vpChildren_i[k]);
+         vpChildren_i[k] = tree.vpChildren_i[k];
+         acquireNode(vpChildren_i[k]);
+      }
+   }
+
+   /**
+    * Releases all of this node's children, leaving it as a leaf node.
+    */
+   void releaseChildren()
+   {
+      if(!isLeaf_i)
+      {
+         for(int k=0; k<N_ACTIONS; ++k)
+         {
+            assert(0!=vpChildren_i[k]);
+            releaseNode(vpChildren_i[k]);
+            vpChildren_i[k]=0;
+         }
+      }
+      isLeaf_i = true;
+   }
+
+   /**
+    * Moves all of another node's children and statistics to this node,
+    * leaving the other node as an empty leaf.
+    * @pre this node must have no children.
+    */
+   void takeFrom(UCTreeNode& tree)
+   {
+      isLeaf_i = tree.isLeaf_i;
+      nVisits_i = tree.nVisits_i;
+      totValue_i = tree.totValue_i;
+      for(int k=0; k<N_ACTIONS; ++k)
+      {
+         assert(0==vpChildren_i[k]);
+         vpChildren_i[k] = tree.vpChildren_i[k];
+         tree.vpChildren_i[k] = 0;
+      }
+      tree.isLeaf_i = true;
+      tree.nVisits_i = 0;
+      tree.totValue_i = 0;
+   }
+
+   /**
+    * Returns the child for a given action, first replacing it with a private
+    * copy if it is shared with another tree, so that it may safely be
+    * modified.
+    * @pre This must not be a leaf node.
+    */
+   UCTreeNode* mutableChild(int action)
+   {
+      UCTreeNode* pChild = vpChildren_i[action];
+      assert(0!=pChild);
+      if(1==pChild->refCount_i.load(std::memory_order_acquire))
+      {
+         return pChild;
+      }
+      void* p = Storage::allocate(sizeof(UCTreeNode));
+      UCTreeNode* pCopy = new (p) UCTreeNode(*pChild,ShareTag());
+      releaseNode(pChild);
+      vpChildren_i[action] = pCopy;
+      return pCopy;
+   }
+
+   /**
+    * Tag type used to select the sharing constructor.
+    */
+   struct ShareTag {};
+
+   /**
+    * Shallow copy constructor, which shares all of \c tree's children.
+    */
+   UCTreeNode(const UCTreeNode& tree, ShareTag)
+      : refCount_i(1), isLeaf_i(true), nVisits_i(tree.nVisits_i),
+        totValue_i(tree.totValue_i), gamma_i(tree.gamma_i),
+        rand_i(tree.rand_i)
+   {
+      for(int k=0; k<N_ACTIONS; ++k)
+      {
+         vpChildren_i[k] = 0;
+      }
+      shareChildren(tree);
+   }
+
    /**
     * Array of pointers (one per action) to all children of this node.
     */
    UCTreeNode* vpChildren_i[N_ACTIONS];
 
+   /**
+    * Number of parents (in this or any forked tree) which refer to this
+    * node. This is always 1 for root nodes.
+    */
+   std::atomic<int> refCount_i;
+
    /**
     * True iff this is a leaf node with no children. If this variable is true
     * then all elements of the UCTreeNode::vpChildren_i array should be null,
@@ -175,7 +478,7 @@ private:
       isLeaf_i = false;
       for (int k=0; k<N_ACTIONS; ++k)
       {
-         vpChildren_i[k] = new UCTreeNode();
+         vpChildren_i[k] = newNode();
       }
 
    } // expand 
@@ -189,19 +492,68 @@ private:
     * @return the estimated rollout value for \c node.
     */
    template<class Generator> double rollOut(Generator mdp)
+   {
+      double discount = 1.0;
+      return rollOut(mdp,MAX_ROLLOUT_ITERATIONS,discount);
+
+   } // rollout
+
+   /**
+    * Performs a fixed number of random actions, advancing \c mdp in place.
+    * This is used both for full rollouts, and for truncated rollouts whose
+    * remaining value is estimated by a separate evaluator.
+    * @param[in,out] mdp A number generator which returns a reward for a given
+    * action. On return, this is left in the state reached by the rollout.
+    * @param[in] nSteps the number of random actions to perform.
+    * @param[in,out] discount the discount applied to the first reward. On
+    * return, this holds the discount to apply to any value after the last
+    * step.
+    * @return the total discounted reward received during the rollout.
+    */
+   template<class Generator> double rollOut
+   (
+    Generator& mdp,
+    int nSteps,
+    double& discount
+   )
+   {
+      return rollOut(mdp,nSteps,discount,rand_i);
+
+   } // rollout
+
+   /**
+    * Performs a fixed number of random actions, as above, but drawing
+    * actions from a given random number generator instead of this node's
+    * own. This allows rollouts to be performed without holding a lock on
+    * the tree.
+    * @param[in,out] mdp A number generator which returns a reward for a given
+    * action. On return, this is left in the state reached by the rollout.
+    * @param[in] nSteps the number of random actions to perform.
+    * @param[in,out] discount the discount applied to the first reward. On
+    * return, this holds the discount to apply to any value after the last
+    * step.
+    * @param[in,out] urand the generator used to select actions.
+    * @return the total discounted reward received during the rollout.
+    */
+   template<class Generator> double rollOut
+   (
+    Generator& mdp,
+    int nSteps,
+    double& discount,
+    URand& urand
+   ) const
    {
       //***********************************************************************
       // Perform random actions until we reach the maximum number of
       // iterations.
       //***********************************************************************
-      double discount = 1.0;
       double totReward = 0.0;
-      for(int k=0; k<MAX_ROLLOUT_ITERATIONS; ++k)
+      for(int k=0; k<nSteps; ++k)
       {
          //********************************************************************
          // Perform random action an update reward
          //********************************************************************
-         int action = rand_i()*N_ACTIONS;
+         int action = urand()*N_ACTIONS;
          totReward += discount*mdp(action);
 
          //********************************************************************
@@ -215,6 +567,81 @@ private:
 
    } // rollout
 
+   /**
+    * Transverses the tree from this node, following the highest value path
+    * until a leaf is found, and then expands that leaf by depth 1.
+    * @param[in,out] mdp generator used to obtain rewards for each action. On
+    * return, this is left in the state reached at the end of the path.
+    * @param[out] visited the nodes visited, with the new leaf on top.
+    * @param[out] rewards the immediate rewards received on entering each
+    * visited node, with a zero place holder for this node.
+    */
+   template<class Generator> void selectPath
+   (
+    Generator& mdp,
+    std::stack<UCTreeNode*>& visited,
+    std::stack<double>& rewards
+   )
+   {
+      //***********************************************************************
+      // Initially the path holds only the current node. The zero reward
+      // for this node has no real effect on the result, but simplifies the
+      // backup algorithm applied later on.
+      //***********************************************************************
+      UCTreeNode* pCur = this;
+      visited.push(this);
+      rewards.push(0.0);
+
+      //***********************************************************************
+      // Transverse the highest value path from the current node, until
+      // we hit a leaf node. We also record rewards for each action as we go
+      // along.
+      //***********************************************************************
+      int action = 0; // next selected action
+      while (!pCur->isLeaf())
+      {
+         action = pCur->selectAction();
+         pCur = pCur->mutableChild(action);
+         visited.push(pCur);
+         rewards.push(mdp(action));
+      }
+
+      //***********************************************************************
+      // Expand the current (leaf) node by depth 1, and select its best child.
+      //***********************************************************************
+      pCur->expand();
+      action = pCur->selectAction();
+      pCur = pCur->vpChildren_i[action];
+      visited.push(pCur);
+      rewards.push(mdp(action));
+
+   } // selectPath
+
+   /**
+    * Updates the statistics for each node along a path using the discounted
+    * value of its leaf.
+    * @param[in] visited the path, as generated by UCTreeNode::selectPath.
+    * @param[in] rewards the rewards, as generated by UCTreeNode::selectPath.
+    * @param[in] value the estimated value of the leaf at the top of the path.
+    */
+   void backup
+   (
+    std::stack<UCTreeNode*> visited,
+    std::stack<double> rewards,
+    double value
+   )
+   {
+      while(!visited.empty())
+      {
+         assert(visited.size()==rewards.size()); // should always be true
+         value = rewards.top() + gamma_i*value;  // update the total value
+         visited.top()->updateStats(value);      // update statistics
+         visited.pop();              // remove the current node from the stack
+         rewards.pop();
+      }
+
+   } // backup
+
    /**
     * Updates the statistics for this node for a given observed value.
     * @param[in] value the observed value.
@@ -225,6 +652,64 @@ private:
       totValue_i += value; // update the total value for all visits
    }
 
+   /**
+    * Counts a pending visit to this node, whose value is not yet known,
+    * as a visit with value <tt>-loss</tt>.
+    * @param[in] loss the virtual loss to apply.
+    */
+   void addVirtualLoss(double loss)
+   {
+      nVisits_i++;
+      totValue_i -= loss;
+   }
+
+   /**
+    * Replaces a virtual loss previously applied by
+    * UCTreeNode::addVirtualLoss with the real observed value.
+    * @param[in] value the observed value.
+    * @param[in] loss the virtual loss that was applied.
+    */
+   void revertVirtualLoss(double value, double loss)
+   {
+      totValue_i += value + loss;
+   }
+
+   /**
+    * Removes a virtual loss previously applied by
+    * UCTreeNode::addVirtualLoss, for an iteration which will never complete.
+    * @param[in] loss the virtual loss that was applied.
+    */
+   void removeVirtualLoss(double loss)
+   {
+      nVisits_i--;
+      totValue_i += loss;
+   }
+
+   /**
+    * Removes the virtual loss from every node left on an iteration's path
+    * when it goes out of scope. Since a completed iteration empties its
+    * path as it backs up, this only has an effect if the iteration fails,
+    * or its coroutine is destroyed while suspended.
+    * @pre the nodes on the path must not have been pruned or discarded by
+    * UCTreeNode::advance since they were visited, as this holds raw pointers
+    * to them. Suspended tasks must therefore be completed or destroyed
+    * before the tree is pruned or advanced.
+    */
+   struct VirtualLossGuard
+   {
+      std::stack<UCTreeNode*>& visited;
+      double loss;
+
+      ~VirtualLossGuard()
+      {
+         while(!visited.empty())
+         {
+            visited.top()->removeVirtualLoss(loss);
+            visited.pop();
+         }
+      }
+   };
+
 public:
 
    /**
@@ -234,8 +719,8 @@ public:
     * rollout.
     */
    UCTreeNode(double inGamma=DEFAULT_GAMMA,URand inRand=URand())
-      : isLeaf_i(true), nVisits_i(0), totValue_i(0), gamma_i(inGamma),
-        rand_i(inRand)
+      : refCount_i(1), isLeaf_i(true), nVisits_i(0), totValue_i(0),
+        gamma_i(inGamma), rand_i(inRand)
    {
       //***********************************************************************
       // Since this is a leaf node with no children, all child pointers
@@ -250,13 +735,24 @@ public:
 
    /**
     * Copy constructor. Performs a deep copy, including all children.
+    * Use UCTreeNode::fork() instead for a cheap copy which shares children
+    * with the original.
     * @param[in] tree the tree to copy.
     */
    UCTreeNode(const UCTreeNode& tree)
-      : isLeaf_i(tree.isLeaf_i), nVisits_i(tree.nVisits_i),
+      : refCount_i(1), isLeaf_i(tree.isLeaf_i), nVisits_i(tree.nVisits_i),
         totValue_i(tree.totValue_i), gamma_i(tree.gamma_i),
         rand_i(tree.rand_i)
    {
+      //***********************************************************************
+      // Start with all child pointers null, so that a copied leaf node has
+      // no children, just like a newly constructed one.
+      //***********************************************************************
+      for(int k=0; k<N_ACTIONS; ++k)
+      {
+         vpChildren_i[k] = 0;
+      }
+
       //***********************************************************************
       // If we've just copied a leaf node, then we're done
       //***********************************************************************
@@ -271,11 +767,28 @@ public:
       for(int k=0; k<N_ACTIONS; ++k)
       {
          assert(0!=tree.vpChildren_i[k]);
-         vpChildren_i[k] = new UCTreeNode(*tree.vpChildren_i[k]);
+         vpChildren_i[k] = newNode(tree.vpChildren_i[k]);
       }
 
    } // copy constructor
 
+   /**
+    * Move constructor. Takes ownership of all of \c tree's children without
+    * copying, leaving \c tree as an unvisited leaf node.
+    * @param[in] tree the tree to move.
+    */
+   UCTreeNode(UCTreeNode&& tree)
+      : refCount_i(1), isLeaf_i(true), nVisits_i(0), totValue_i(0),
+        gamma_i(tree.gamma_i), rand_i(tree.rand_i)
+   {
+      for(int k=0; k<N_ACTIONS; ++k)
+      {
+         vpChildren_i[k] = 0;
+      }
+      takeFrom(tree);
+
+   } // move constructor
+
    /**
     * Copy assignment. Performs a deep copy, including all children.
     * @param[in] tree the tree to copy.
@@ -283,45 +796,170 @@ public:
    UCTreeNode& operator=(const UCTreeNode& tree)
    {
       //***********************************************************************
-      // Delete old children if necessary
+      // Copy and then move, so that we are left unchanged if the copy fails,
+      // and self assignment is harmless.
       //***********************************************************************
+      UCTreeNode copy(tree);
+      return *this = std::move(copy);
+
+   } // operator=
+
+   /**
+    * Move assignment. Releases this node's existing children, and then takes
+    * ownership of all of \c tree's children without copying, leaving
+    * \c tree as an unvisited leaf node.
+    * @param[in] tree the tree to move.
+    */
+   UCTreeNode& operator=(UCTreeNode&& tree)
+   {
+      if(this==&tree)
+      {
+         return *this;
+      }
+      releaseChildren();
+      gamma_i = tree.gamma_i;
+      rand_i = tree.rand_i;
+      takeFrom(tree);
+      return *this;
+
+   } // move assignment
+
+   /**
+    * Creates a new tree which initially shares all of this tree's nodes.
+    * This takes O(N_ACTIONS) time regardless of the size of the tree. Later
+    * iterations of either tree copy only those nodes that they modify, so
+    * neither tree is affected by iterations of the other.
+    *
+    * Forked trees may be searched concurrently by different threads, but
+    * no tree should be forked while any of its iterations are in progress,
+    * including those with leaves pending in a mcts::LeafEvalQueue.
+    * @returns the new tree.
+    */
+   UCTreeNode fork() const
+   {
+      return UCTreeNode(*this,ShareTag());
+   }
+
+   /**
+    * Releases a single node without destroying its children. If this was the
+    * last reference to \c node, it is destroyed, and its children are
+    * appended to \c children. This allows large trees to be destroyed
+    * incrementally, for example by mcts::TreeReclaimer.
+    * @param[in] node the node to release, which must have been allocated
+    * by this class's storage policy (i.e. must not be a root node).
+    * @param[in,out] children vector to which the node's children are added,
+    * if it is destroyed. The caller takes over the references to these
+    * children.
+    * @returns true iff \c node was destroyed.
+    */
+   static bool reclaim(UCTreeNode* node, std::vector<UCTreeNode*>& children)
+   {
+      if(1!=node->refCount_i.fetch_sub(1,std::memory_order_acq_rel))
+      {
+         return false;
+      }
+      if(!node->isLeaf_i)
+      {
+         for(int k=0; k<N_ACTIONS; ++k)
+         {
+            assert(0!=node->vpChildren_i[k]);
+            children.push_back(node->vpChildren_i[k]);
+            node->vpChildren_i[k] = 0;
+         }
+         node->isLeaf_i = true;
+      }
+      deleteNode(node);
+      return true;
+
+   } // reclaim
+
+   /**
+    * Discards all of this node's children, handing them to a reclaimer for
+    * destruction, and resets this node to an unvisited leaf. This takes
+    * O(N_ACTIONS) time regardless of the size of the tree.
+    * @param[in] reclaimer object which will destroy the discarded subtrees,
+    * such as mcts::TreeReclaimer.
+    * @pre no iteration of this tree may be in progress. In particular, any
+    * mcts::LeafEvalQueue used with UCTreeNode::iterate must have been
+    * drained, and every task returned by UCTreeNode::iterateAsync must have
+    * completed or been destroyed, since both hold raw pointers to the nodes
+    * on their paths, which the reclaimer may destroy at any time.
+    */
+   template<class Reclaimer> void prune(Reclaimer& reclaimer)
+   {
       if(!isLeaf_i)
       {
          for(int k=0; k<N_ACTIONS; ++k)
          {
-            assert(0!=vpChildren_i[k]);
-            delete vpChildren_i[k];
-            vpChildren_i[k]=0;
+            reclaimer.retire(vpChildren_i[k]);
+            vpChildren_i[k] = 0;
+         }
+         isLeaf_i = true;
+      }
+      nVisits_i = 0;
+      totValue_i = 0;
 
-         } // for loop
+   } // prune
 
-      } // if statement
+   /**
+    * Makes the subtree for a given action the new tree rooted at this node,
+    * handing all sibling subtrees to a reclaimer for destruction. This is
+    * typically called after \c action has been taken, to reuse the search
+    * results below it. This takes O(N_ACTIONS) time regardless of the size
+    * of the tree. The discount factor and random number generator of this
+    * node are kept.
+    * @param[in] action the action taken.
+    * @param[in] reclaimer object which will destroy the discarded subtrees,
+    * such as mcts::TreeReclaimer.
+    * @pre as for UCTreeNode::prune, no iteration of this tree may be in
+    * progress.
+    */
+   template<class Reclaimer> void advance(int action, Reclaimer& reclaimer)
+   {
+      assert(0<=action);
+      assert(N_ACTIONS>action);
 
       //***********************************************************************
-      // Set all scalar members
+      // If this is a leaf node, there's nothing to keep.
       //***********************************************************************
-      isLeaf_i = tree.isLeaf_i;
-      nVisits_i = tree.nVisits_i;
-      totValue_i = tree.totValue_i;
-      gamma_i = tree.gamma_i;
-      rand_i = tree.rand_i;
+      if(isLeaf_i)
+      {
+         prune(reclaimer);
+         return;
+      }
 
       //***********************************************************************
-      // Copy new children if necessary
+      // Otherwise, hand the siblings of the chosen child to the reclaimer.
       //***********************************************************************
-      if(!isLeaf_i)
+      UCTreeNode* pChild = vpChildren_i[action];
+      for(int k=0; k<N_ACTIONS; ++k)
       {
-         for(int k=0; k<N_ACTIONS; ++k)
+         if(action!=k)
          {
-            assert(0!=tree.vpChildren_i[k]);
-            assert(0==vpChildren_i[k]);
-            vpChildren_i[k] = new UCTreeNode(*tree.vpChildren[k]);
-
-         } // for loop
+            reclaimer.retire(vpChildren_i[k]);
+         }
+         vpChildren_i[k] = 0;
+      }
 
-      } // if statement
+      //***********************************************************************
+      // Take over the chosen child's statistics and children. If the child
+      // is not shared with a forked tree, we can simply steal its children,
+      // leaving it as an empty leaf which can be destroyed cheaply.
+      // Otherwise, we share its children, and leave it to the other tree.
+      //***********************************************************************
+      if(1==pChild->refCount_i.load(std::memory_order_acquire))
+      {
+         takeFrom(*pChild);
+      }
+      else
+      {
+         nVisits_i = pChild->nVisits_i;
+         totValue_i = pChild->totValue_i;
+         shareChildren(*pChild);
+      }
+      releaseNode(pChild);
 
-   } // operator=
+   } // advance
 
    /**
     * Returns true iff this is a leaf node with no children.
@@ -345,68 +983,180 @@ public:
    template<class Generator> void iterate(Generator mdp)
    {
       //***********************************************************************
-      // Create stack to hold the path visited on this iteration.
-      // Initially this holds only the current node.
+      // Transverse the tree and expand the leaf at the end of the path.
       //***********************************************************************
       std::stack<UCTreeNode*> visited;
-      UCTreeNode* pCur = this;
-      visited.push(this);
+      std::stack<double> rewards;
+      selectPath(mdp,visited,rewards);
 
       //***********************************************************************
-      // Create stack to hold immediate rewards generated as we transverse
-      // the tree. Initially, this zero as a place holder for the reward
-      // received for the root node. This has no real effect on the result,
-      // but simplifies the backup algorithm applied later on.
+      // Estimate the value of the new leaf node using the rollout policy
       //***********************************************************************
+      double value = rollOut(mdp);
+
+      //***********************************************************************
+      // Update the statistics for each node along the path using the
+      // discounted value. 
+      //***********************************************************************
+      backup(visited,rewards,value);
+
+   } // iterate
+
+   /**
+    * Performs one iteration of the MCTS algorithm, taking this to be the root
+    * node, but estimating the value of the new leaf using a (possibly
+    * truncated) rollout followed by an evaluator queue, such as
+    * mcts::LeafEvalQueue.
+    *
+    * The leaf is parked in the queue, and each node on its path is given a
+    * virtual loss until its value is backed up, so that further iterations
+    * are steered towards other paths in the meantime. The backup may happen
+    * asynchronously, after this function returns, and on another thread.
+    *
+    * This function may be called concurrently from several threads, provided
+    * that all threads use the same queue, and that no other member function
+    * is called on the tree without holding EvalQueue::treeMutex().
+    * Since the queue holds raw pointers to the path until its value is
+    * backed up, the queue must be drained before the tree is pruned or
+    * advanced.
+    * @param[in] mdp A number generator which returns a reward for a given
+    * action. The state reached at the end of the path is passed to the queue.
+    * @param[in] queue the queue used to evaluate the leaf.
+    * @param[in] rolloutSteps the number of random rollout steps performed
+    * before the leaf is submitted to the queue. If 0, the evaluator replaces
+    * the rollout entirely. These steps draw actions from mcts::threadRand,
+    * rather than from this node's own generator.
+    * @tparam[in] Generator Functor type which overloads the () operator by
+    * returning a random reward for a given action index.
+    * @tparam[in] EvalQueue queue type which provides \c treeMutex(),
+    * \c virtualLoss() and \c submit(state,callback) members.
+    */
+   template<class Generator, class EvalQueue> void iterate
+   (
+    Generator mdp,
+    EvalQueue& queue,
+    int rolloutSteps=0
+   )
+   {
+      //***********************************************************************
+      // Select and expand a new leaf, and apply virtual loss to its path,
+      // while holding the tree lock.
+      //***********************************************************************
+      std::stack<UCTreeNode*> visited;
       std::stack<double> rewards;
+      std::unique_lock<std::mutex> lock(queue.treeMutex());
+      selectPath(mdp,visited,rewards);
+      PendingPath<UCTreeNode> pending(std::move(visited),std::move(rewards),
+         gamma_i,queue.virtualLoss());
+      lock.unlock();
+
+      //***********************************************************************
+      // Perform any rollout steps without the lock, so that several search
+      // threads can call their generators at the same time. Actions are
+      // drawn from this thread's own random number generator.
+      //***********************************************************************
+      double discount = 1.0;
+      double partial = rollOut(mdp,rolloutSteps,discount,threadRand<URand>());
+      pending.setRollout(partial,discount);
+
+      //***********************************************************************
+      // Park the leaf in the queue. When its value is available, the queue
+      // calls back (holding the tree lock) to replace the virtual loss with
+      // the real discounted value.
+      //***********************************************************************
+      queue.submit(mdp,pending);
+
+   } // iterate
+
+#if defined(__cpp_impl_coroutine)
+   /**
+    * Performs one iteration of the MCTS algorithm as a coroutine, taking this
+    * to be the root node, for use with generators whose steps are slow and
+    * can be awaited, such as mcts::SimulatorClient.
+    *
+    * Each node on the iteration's path is given a virtual loss as soon as it
+    * is entered, so that other iterations in flight at the same time are
+    * steered towards other paths. The virtual loss is replaced with the real
+    * discounted value when the rollout completes. If the iteration fails, or
+    * its task is destroyed before it completes, the virtual loss and visit
+    * are removed instead, leaving the statistics as they were.
+    *
+    * All iterations of a tree must be resumed on the same thread, which is
+    * usually the thread running mcts::searchAsync.
+    * @param[in] mdp generator whose \c step(action) member returns an
+    * awaitable which yields the reward for \c action.
+    * @param[in] rolloutSteps number of random rollout steps performed from
+    * the new leaf.
+    * @param[in] loss the virtual loss applied to each node on the path.
+    * @returns a task which must be started, and must outlive the iteration.
+    * It must also complete, or be destroyed, before this tree is pruned or
+    * advanced.
+    */
+   template<class Generator> AsyncTask iterateAsync
+   (
+    Generator mdp,
+    int rolloutSteps=MAX_ROLLOUT_ITERATIONS,
+    double loss=DEFAULT_VIRTUAL_LOSS
+   )
+   {
+      std::stack<UCTreeNode*> visited;
+      std::stack<double> rewards;
+      VirtualLossGuard guard = { visited, loss };
+      UCTreeNode* pCur = this;
+      visited.push(this);
       rewards.push(0.0);
+      addVirtualLoss(loss);
 
       //***********************************************************************
-      // Transverse the highest value path from the current node, until
-      // we hit a leaf node. We also record rewards for each action as we go
-      // along.
+      // Transverse the tree until we hit a leaf. Other iterations may expand
+      // the current node while we wait for a reward, in which case we just
+      // carry on down.
       //***********************************************************************
-      int action = 0; // next selected action
-      double curReward = 0.0; // immediate reward for last action
+      int action = 0;
       while (!pCur->isLeaf())
       {
          action = pCur->selectAction();
-         pCur = pCur->vpChildren_i[action];
+         pCur = pCur->mutableChild(action);
          visited.push(pCur);
-         curReward = mdp(action);
-         rewards.push(curReward);
+         pCur->addVirtualLoss(loss);
+         rewards.push(co_await mdp.step(action));
       }
 
       //***********************************************************************
-      // Expand the current (leaf) node by depth 1, and select its best child.
+      // Expand the leaf, and select its best child.
       //***********************************************************************
       pCur->expand();
       action = pCur->selectAction();
       pCur = pCur->vpChildren_i[action];
       visited.push(pCur);
-      curReward = mdp(action);
-      rewards.push(curReward);
+      pCur->addVirtualLoss(loss);
+      rewards.push(co_await mdp.step(action));
 
       //***********************************************************************
-      // Estimate the value of the new leaf node using the rollout policy
+      // Estimate the value of the new leaf using the rollout policy.
       //***********************************************************************
-      double value = rollOut(mdp);
+      double discount = 1.0;
+      double value = 0.0;
+      for(int k=0; k<rolloutSteps; ++k)
+      {
+         action = rand_i()*N_ACTIONS;
+         value += discount*(co_await mdp.step(action));
+         discount *= gamma_i;
+      }
 
       //***********************************************************************
-      // Update the statistics for each node along the path using the
-      // discounted value. 
+      // Replace the virtual loss on each node with the discounted value.
       //***********************************************************************
       while(!visited.empty())
       {
-         assert(visited.size()==rewards.size()); // should always be true
-         value = rewards.top() + gamma_i*value;  // update the total value
-         pCur = visited.top();       // get the current node in the path
-         pCur->updateStats(value);   // update statistics
-         visited.pop();              // remove the current node from the stack
+         value = rewards.top() + gamma_i*value;
+         visited.top()->revertVirtualLoss(value,loss);
+         visited.pop();
          rewards.pop();
       }
 
-   } // iterate
+   } // iterateAsync
+#endif // __cpp_impl_coroutine
 
    /**
     * Returns the current best action for the next step.
@@ -471,6 +1221,15 @@ public:
 
    } // bestAction
 
+   /**
+    * Returns the number of times this node has been visited, including
+    * pending visits that currently carry a virtual loss.
+    */
+   double numOfVisits() const
+   {
+      return nVisits_i;
+   }
+
    /**
     * Returns the expected value for this tree.
     */
@@ -553,24 +1312,12 @@ public:
    } // maxDepth
 
    /**
-    * Destructor deletes all child nodes in addition to this one.
+    * Destructor deletes all child nodes in addition to this one, except for
+    * those still shared with a forked tree.
     */
    virtual ~UCTreeNode()
    {
-
-      if(isLeaf_i)
-      {
-         return;
-      }
-
-      for(int k=0; k<N_ACTIONS; ++k)
-      {
-         if(0!=vpChildren_i[k])
-         {
-            delete vpChildren_i[k];
-            vpChildren_i[k]=0;
-         }
-      }
+      releaseChildren();
 
    } // destructor 
 
@@ -580,10 +1327,10 @@ public:
  * Produces a string representation of a treeNode for diagnostic purposes.
  * Basically, just prints the vValue and the qValue for each action.
  */
-template<int N_ACTIONS> std::ostream& operator<<
+template<int N_ACTIONS, class URand, class Storage> std::ostream& operator<<
 (
  std::ostream& out,
- const UCTreeNode<N_ACTIONS>& tree
+ const UCTreeNode<N_ACTIONS,URand,Storage>& tree
 )
 {
 
@@ -0,0 +1,340 @@
+/**
+ * @file TreeReclaimer.h
+ * This file defines the mcts::TreeReclaimer class, which destroys discarded
+ * subtrees in the background.
+ */
+#ifndef MCTS_TREERECLAIMER_H
+#define MCTS_TREERECLAIMER_H
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mcts {
+
+/**
+ * Default number of nodes destroyed by mcts::TreeReclaimer between checks
+ * of its rate limit.
+ */
+const int DEFAULT_RECLAIM_BATCH_SIZE = 1024;
+
+/**
+ * Statistics reported by mcts::TreeReclaimer.
+ */
+struct ReclaimStats
+{
+   /**
+    * Number of subtrees handed to the reclaimer.
+    */
+   long nRetired;
+
+   /**
+    * Number of nodes destroyed so far. This excludes nodes which were
+    * released, but not destroyed, because they are still shared with a
+    * forked tree.
+    */
+   long nFreed;
+
+   /**
+    * Number of nodes known to be waiting for destruction. Since subtrees
+    * are not counted when they are retired, this is the frontier of the
+    * backlog rather than its full size: each pending node may still have
+    * descendants of its own.
+    */
+   long nPending;
+
+   /**
+    * Largest value of ReclaimStats::nPending observed so far.
+    */
+   long maxPending;
+
+   ReclaimStats() : nRetired(0), nFreed(0), nPending(0), maxPending(0) {}
+
+}; // struct ReclaimStats
+
+/**
+ * Destroys discarded subtrees, one node at a time, so that the thread which
+ * discards them does not pay the cost of a recursive destructor.
+ *
+ * Subtrees are handed over using TreeReclaimer::retire(), which only records
+ * the subtree's root. Nodes are then destroyed either by a background thread
+ * (in asynchronous mode) or by explicit calls to TreeReclaimer::reclaim().
+ * Each destroyed node has its children added to the backlog, so the backlog
+ * is processed depth first without recursion.
+ *
+ * The background thread can be limited to a maximum number of nodes per
+ * second, so that it does not compete with search threads for CPU time or
+ * allocator locks.
+ * @tparam Node the tree node type, which must provide
+ * <tt>static bool reclaim(Node*, std::vector<Node*>&)</tt>, releasing a
+ * single node, and returning true iff it was destroyed, in which case its
+ * children are appended to the vector.
+ */
+template<class Node> class TreeReclaimer
+{
+private:
+
+   typedef std::chrono::steady_clock Clock;
+
+   /**
+    * Maximum number of nodes destroyed per second, or 0 for no limit.
+    */
+   double maxRate_i;
+
+   /**
+    * Number of nodes destroyed between checks of the rate limit.
+    */
+   int batchSize_i;
+
+   /**
+    * Lock protecting all of the following members.
+    */
+   std::mutex mutex_i;
+
+   /**
+    * Signalled when subtrees are retired, or the reclaimer is stopped.
+    */
+   std::condition_variable retired_i;
+
+   /**
+    * Signalled when the backlog becomes empty.
+    */
+   std::condition_variable empty_i;
+
+   /**
+    * Nodes waiting to be destroyed.
+    */
+   std::vector<Node*> backlog_i;
+
+   /**
+    * Number of nodes taken from the backlog, but not yet destroyed.
+    */
+   int nInFlight_i;
+
+   /**
+    * True iff the worker thread should exit.
+    */
+   bool stopping_i;
+
+   /**
+    * Statistics gathered so far.
+    */
+   ReclaimStats stats_i;
+
+   /**
+    * Worker thread used in asynchronous mode.
+    */
+   std::thread worker_i;
+
+   /**
+    * Destroys up to \c maxNodes nodes from the backlog.
+    * @param[in,out] lock lock on mutex_i, which is released while nodes are
+    * being destroyed.
+    * @returns the number of pending nodes processed.
+    */
+   int reclaimLocked(std::unique_lock<std::mutex>& lock, int maxNodes)
+   {
+      //***********************************************************************
+      // Take a batch of nodes from the top of the backlog.
+      //***********************************************************************
+      std::vector<Node*> batch;
+      while(!backlog_i.empty() && static_cast<int>(batch.size())<maxNodes)
+      {
+         batch.push_back(backlog_i.back());
+         backlog_i.pop_back();
+      }
+      nInFlight_i += batch.size();
+
+      //***********************************************************************
+      // Destroy each node without holding the lock, collecting its children.
+      //***********************************************************************
+      lock.unlock();
+      std::vector<Node*> children;
+      int nFreed = 0;
+      for(std::size_t k=0; k<batch.size(); ++k)
+      {
+         nFreed += Node::reclaim(batch[k],children) ? 1 : 0;
+      }
+      lock.lock();
+
+      //***********************************************************************
+      // Add the children to the backlog, and update statistics.
+      //***********************************************************************
+      backlog_i.insert(backlog_i.end(),children.begin(),children.end());
+      nInFlight_i -= batch.size();
+      stats_i.nFreed += nFreed;
+      updatePending();
+      if(backlog_i.empty() && 0==nInFlight_i)
+      {
+         empty_i.notify_all();
+      }
+      return batch.size();
+
+   } // reclaimLocked
+
+   /**
+    * Updates the pending statistics.
+    * @pre mutex_i must be held by the caller.
+    */
+   void updatePending()
+   {
+      stats_i.nPending = backlog_i.size() + nInFlight_i;
+      if(stats_i.maxPending < stats_i.nPending)
+      {
+         stats_i.maxPending = stats_i.nPending;
+      }
+   }
+
+   /**
+    * Main loop for the worker thread in asynchronous mode.
+    */
+   void run()
+   {
+      std::unique_lock<std::mutex> lock(mutex_i);
+      Clock::time_point start = Clock::now();
+      long nSinceStart = 0;
+      while(!stopping_i)
+      {
+         if(backlog_i.empty())
+         {
+            retired_i.wait(lock);
+            start = Clock::now();
+            nSinceStart = 0;
+            continue;
+         }
+         nSinceStart += reclaimLocked(lock,batchSize_i);
+
+         //********************************************************************
+         // If we're ahead of the rate limit, sleep until we're back on it.
+         //********************************************************************
+         if(0<maxRate_i)
+         {
+            Clock::time_point due = start + std::chrono::duration_cast
+               <Clock::duration>(std::chrono::duration<double>
+                  (nSinceStart/maxRate_i));
+            retired_i.wait_until(lock,due,[this]{ return stopping_i; });
+         }
+      }
+
+   } // run
+
+public:
+
+   /**
+    * Constructs a new reclaimer.
+    * @param[in] async if true, nodes are destroyed by a background thread.
+    * Otherwise, they are destroyed only by calls to
+    * TreeReclaimer::reclaim().
+    * @param[in] maxNodesPerSecond maximum rate at which the background
+    * thread destroys nodes, or 0 for no limit.
+    * @param[in] batchSize number of nodes destroyed between checks of the
+    * rate limit.
+    */
+   TreeReclaimer
+   (
+    bool async=true,
+    double maxNodesPerSecond=0,
+    int batchSize=DEFAULT_RECLAIM_BATCH_SIZE
+   )
+      : maxRate_i(maxNodesPerSecond), batchSize_i(batchSize), nInFlight_i(0),
+        stopping_i(false)
+   {
+      assert(0<batchSize_i);
+      if(async)
+      {
+         worker_i = std::thread(&TreeReclaimer::run,this);
+      }
+   }
+
+   /**
+    * Hands a subtree over for destruction. This takes constant time.
+    * @param[in] subtree root of the subtree, which must have been allocated
+    * by the Node type's storage policy, and must not be referenced again by
+    * the caller.
+    */
+   void retire(Node* subtree)
+   {
+      if(0==subtree)
+      {
+         return;
+      }
+      std::lock_guard<std::mutex> lock(mutex_i);
+      const bool wasEmpty = backlog_i.empty();
+      backlog_i.push_back(subtree);
+      stats_i.nRetired++;
+      updatePending();
+
+      //***********************************************************************
+      // The worker only waits for new work when the backlog is empty, so
+      // there's no need to wake it otherwise.
+      //***********************************************************************
+      if(wasEmpty)
+      {
+         retired_i.notify_one();
+      }
+   }
+
+   /**
+    * Destroys up to \c maxNodes pending nodes on the calling thread.
+    * @returns the number of pending nodes processed, which is 0 iff there
+    * were none left.
+    */
+   int reclaim(int maxNodes)
+   {
+      std::unique_lock<std::mutex> lock(mutex_i);
+      return reclaimLocked(lock,maxNodes);
+   }
+
+   /**
+    * Destroys all pending nodes, using the calling thread to help the
+    * background thread (if any), and ignoring the rate limit.
+    */
+   void drain()
+   {
+      std::unique_lock<std::mutex> lock(mutex_i);
+      while(!backlog_i.empty() || 0<nInFlight_i)
+      {
+         if(backlog_i.empty())
+         {
+            empty_i.wait(lock);
+            continue;
+         }
+         reclaimLocked(lock,batchSize_i);
+      }
+   }
+
+   /**
+    * Returns a copy of the statistics gathered so far.
+    */
+   ReclaimStats stats()
+   {
+      std::lock_guard<std::mutex> lock(mutex_i);
+      return stats_i;
+   }
+
+   /**
+    * Destructor stops the background thread, and destroys any remaining
+    * nodes.
+    */
+   ~TreeReclaimer()
+   {
+      if(worker_i.joinable())
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex_i);
+            stopping_i = true;
+         }
+         retired_i.notify_all();
+         worker_i.join();
+      }
+      drain();
+   }
+
+}; // class TreeReclaimer
+
+} // namespace mcts
+
+#endif // MCTS_TREERECLAIMER_H
@@ -0,0 +1,704 @@
+/**
+ * @file VarTreeNode.h
+ * This file defines the mcts::VarTreeNode class.
+ */
+#ifndef MCTS_VARTREENODE_H
+#define MCTS_VARTREENODE_H
+
+#include <cmath>
+#include <cassert>
+#include <limits>
+#include <stack>
+#include <vector>
+#include <iostream>
+#include <mutex>
+#include <utility>
+#include "TreeNode.h"
+#include "NodeStorage.h"
+
+namespace mcts {
+
+/**
+ * Action index returned when no action is available.
+ */
+const int NO_ACTION = -1;
+
+/**
+ * Represents a node in a UCT tree whose set of legal actions is only known
+ * at runtime, and may differ from node to node.
+ *
+ * Unlike mcts::UCTreeNode, which reserves a child pointer for every action
+ * in the domain, each expanded node holds exactly one child per legal action,
+ * stored in a single contiguous block obtained from the \c Storage policy.
+ * Selection and rollout only ever consider legal actions. Where every
+ * action is legal in every state, and the number of actions is known at
+ * compile time, mcts::UCTreeNode remains the faster choice.
+ *
+ * Generators used with this class must provide, in addition to
+ * <tt>double operator()(int action)</tt>, a member function
+ * <tt>void legalActions(std::vector<int>& actions)</tt> which fills
+ * \c actions with the indices of all actions legal in the generator's
+ * current state. An empty set indicates a terminal state.
+ * @tparam URand class used to generate uniform random numbers in range [0,1).
+ * This is used internally during selection and rollout.
+ * @tparam Storage storage policy used to allocate blocks of children,
+ * such as mcts::HeapStorage.
+ */
+template<class URand=SimpleURand, class Storage=HeapStorage> class VarTreeNode
+{
+private:
+
+   template<class Node> friend class PendingPath;
+
+   /**
+    * Contiguous block of children, one per legal action, or null if this
+    * is a leaf node or a terminal node.
+    */
+   VarTreeNode* vChildren_i;
+
+   /**
+    * Number of children in VarTreeNode::vChildren_i.
+    */
+   int nChildren_i;
+
+   /**
+    * The action which leads from this node's parent to this node, or
+    * mcts::NO_ACTION for the root.
+    */
+   int action_i;
+
+   /**
+    * True iff this is a leaf node which has not yet been expanded. A node
+    * which has been expanded in a terminal state is not a leaf, but has no
+    * children.
+    */
+   bool isLeaf_i;
+
+   /**
+    * Counts the number of time this node has been visited.
+    */
+   double nVisits_i;
+
+   /**
+    * Sum of all values received each time this node has been visited.
+    */
+   double totValue_i;
+
+   /**
+    * Discount factor for future rewards.
+    */
+   double gamma_i;
+
+   /**
+    * Uniform random number generated used for selection and rollout.
+    */
+   URand rand_i;
+
+   /**
+    * Allocates an uninitialised block of children.
+    * @param[in] n the number of children.
+    */
+   static VarTreeNode* allocateChildren(int n)
+   {
+      return static_cast<VarTreeNode*>
+         (Storage::allocate(n*sizeof(VarTreeNode)));
+   }
+
+   /**
+    * Destroys this node's children, and returns their block to storage.
+    * @post this node has no children.
+    */
+   void releaseChildren()
+   {
+      //***********************************************************************
+      // If there are no children, then there's nothing to do.
+      //***********************************************************************
+      if(0==vChildren_i)
+      {
+         return;
+      }
+
+      //***********************************************************************
+      // Otherwise, destroy each child in place, then release their block.
+      //***********************************************************************
+      for(int k=0; k<nChildren_i; ++k)
+      {
+         vChildren_i[k].~VarTreeNode();
+      }
+      Storage::deallocate(vChildren_i,nChildren_i*sizeof(VarTreeNode));
+      vChildren_i = 0;
+      nChildren_i = 0;
+   }
+
+   /**
+    * Deep copies another node's children into a new block.
+    * @pre this node has no children.
+    */
+   void copyChildren(const VarTreeNode& tree)
+   {
+      //***********************************************************************
+      // If the other node has no children, then we're done.
+      //***********************************************************************
+      assert(0==vChildren_i);
+      if(0==tree.nChildren_i)
+      {
+         return;
+      }
+
+      //***********************************************************************
+      // Otherwise, copy each child into a new block of the same size.
+      //***********************************************************************
+      vChildren_i = allocateChildren(tree.nChildren_i);
+      for(int k=0; k<tree.nChildren_i; ++k)
+      {
+         new (vChildren_i+k) VarTreeNode(tree.vChildren_i[k]);
+      }
+      nChildren_i = tree.nChildren_i;
+   }
+
+   /**
+    * Selects the next child to explore using UCB.
+    * @pre This node must have at least one child.
+    * @returns the index of the selected child (not its action).
+    */
+   int selectChild()
+   {
+      //***********************************************************************
+      // Ensure preconditions are met: can't select a child, if there are no
+      // legal actions.
+      //***********************************************************************
+      assert(0<nChildren_i);
+
+      //***********************************************************************
+      // Initialise the selected child, and the best value found so far to
+      // its lowest possible value.
+      //***********************************************************************
+      int selected = 0;
+      double bestValue = -std::numeric_limits<double>::max();
+
+      //***********************************************************************
+      // For each child node, calculate its UCT value, plus a small random
+      // value to break ties, and keep the best one encountered so far.
+      //***********************************************************************
+      for(int k=0; k<nChildren_i; ++k)
+      {
+         const VarTreeNode& cur = vChildren_i[k];
+         double uctValue = cur.totValue_i / (cur.nVisits_i + EPSILON) +
+            std::sqrt(std::log(nVisits_i+1) / (cur.nVisits_i + EPSILON));
+         uctValue += rand_i()*EPSILON;
+         if (uctValue >= bestValue)
+         {
+            selected = k;
+            bestValue = uctValue;
+         }
+      }
+
+      //***********************************************************************
+      // Return the index of the selected child.
+      //***********************************************************************
+      return selected;
+
+   } // selectChild
+
+   /**
+    * If this is a leaf node, expands the tree by constructing one child for
+    * each action that is legal in the generator's current state.
+    * @param[in] legal the legal actions in this node's state.
+    */
+   void expand(const std::vector<int>& legal)
+   {
+      //***********************************************************************
+      // If this is not a leaf node, then we're done. There is nothing to do.
+      //***********************************************************************
+      if(!isLeaf_i)
+      {
+         return;
+      }
+
+      //***********************************************************************
+      // Otherwise, this node is no longer a leaf, even if it turns out to be
+      // terminal, in which case it has no children.
+      //***********************************************************************
+      isLeaf_i = false;
+      if(legal.empty())
+      {
+         return;
+      }
+
+      //***********************************************************************
+      // Construct one child per legal action, in a single block.
+      //***********************************************************************
+      vChildren_i = allocateChildren(legal.size());
+      for(std::size_t k=0; k<legal.size(); ++k)
+      {
+         new (vChildren_i+k) VarTreeNode(gamma_i,rand_i,legal[k]);
+      }
+      nChildren_i = legal.size();
+
+   } // expand
+
+   /**
+    * Performs a number of random legal actions, advancing \c mdp in place.
+    * The rollout stops early if a terminal state is reached.
+    * @param[in,out] mdp the generator.
+    * @param[in] nSteps the maximum number of random actions to perform.
+    * @param[in,out] discount the discount applied to the first reward. On
+    * return, this holds the discount to apply to any value after the last
+    * step.
+    * @param[in] legal scratch space for legal actions.
+    * @return the total discounted reward received during the rollout.
+    */
+   template<class Generator> double rollOut
+   (
+    Generator& mdp,
+    int nSteps,
+    double& discount,
+    std::vector<int>& legal
+   )
+   {
+      return rollOut(mdp,nSteps,discount,legal,rand_i);
+   }
+
+   /**
+    * Performs random legal actions as above, but drawing them from a given
+    * random number generator, so that no lock is needed on the tree.
+    * @param[in,out] urand the generator used to select actions.
+    */
+   template<class Generator> double rollOut
+   (
+    Generator& mdp,
+    int nSteps,
+    double& discount,
+    std::vector<int>& legal,
+    URand& urand
+   ) const
+   {
+      //***********************************************************************
+      // Perform random legal actions until we reach the maximum number of
+      // steps, or a terminal state.
+      //***********************************************************************
+      double totReward = 0.0;
+      for(int k=0; k<nSteps; ++k)
+      {
+         //********************************************************************
+         // Stop if there are no legal actions left.
+         //********************************************************************
+         mdp.legalActions(legal);
+         if(legal.empty())
+         {
+            discount = 0.0; // no further value after a terminal state
+            break;
+         }
+
+         //********************************************************************
+         // Perform a random legal action, and update the reward and the
+         // discount for the next timestep.
+         //********************************************************************
+         int action = legal[static_cast<int>(urand()*legal.size())];
+         totReward += discount*mdp(action);
+         discount *= gamma_i;
+
+      } // for loop
+
+      return totReward;
+
+   } // rollOut
+
+   /**
+    * Transverses the tree from this node, following the highest value path
+    * until a leaf is found, and then expands that leaf by depth 1.
+    * If the leaf turns out to be terminal, the path ends at the leaf.
+    * @param[in,out] mdp the generator.
+    * @param[out] visited the nodes visited, with the new leaf on top.
+    * @param[out] rewards the immediate rewards received on entering each
+    * visited node, with a zero place holder for this node.
+    * @param[in] legal scratch space for legal actions.
+    * @returns true iff the path ends in a terminal state.
+    */
+   template<class Generator> bool selectPath
+   (
+    Generator& mdp,
+    std::stack<VarTreeNode*>& visited,
+    std::stack<double>& rewards,
+    std::vector<int>& legal
+   )
+   {
+      //***********************************************************************
+      // Initially the path holds only the current node, with a zero reward
+      // place holder, as in UCTreeNode::selectPath.
+      //***********************************************************************
+      VarTreeNode* pCur = this;
+      visited.push(this);
+      rewards.push(0.0);
+
+      //***********************************************************************
+      // Transverse the highest value path until we hit a leaf node, or a
+      // terminal node with no children, recording rewards as we go along.
+      //***********************************************************************
+      while (!pCur->isLeaf())
+      {
+         if(0==pCur->nChildren_i)
+         {
+            return true;
+         }
+         pCur = pCur->vChildren_i + pCur->selectChild();
+         visited.push(pCur);
+         rewards.push(mdp(pCur->action_i));
+      }
+
+      //***********************************************************************
+      // Expand the leaf using the actions legal in its state. If there are
+      // none, the path ends here in a terminal state. Otherwise, select the
+      // best new child.
+      //***********************************************************************
+      mdp.legalActions(legal);
+      pCur->expand(legal);
+      if(0==pCur->nChildren_i)
+      {
+         return true;
+      }
+      pCur = pCur->vChildren_i + pCur->selectChild();
+      visited.push(pCur);
+      rewards.push(mdp(pCur->action_i));
+      return false;
+
+   } // selectPath
+
+   /**
+    * Updates the statistics for this node for a given observed value.
+    * @param[in] value the observed value.
+    */
+   void updateStats(double value)
+   {
+      nVisits_i++;
+      totValue_i += value;
+   }
+
+   /**
+    * Counts a pending visit to this node as a visit with value
+    * <tt>-loss</tt>.
+    */
+   void addVirtualLoss(double loss)
+   {
+      nVisits_i++;
+      totValue_i -= loss;
+   }
+
+   /**
+    * Replaces a virtual loss with the real observed value.
+    */
+   void revertVirtualLoss(double value, double loss)
+   {
+      totValue_i += value + loss;
+   }
+
+   /**
+    * Construct a new leaf node reached by a given action.
+    */
+   VarTreeNode(double inGamma, URand inRand, int action)
+      : vChildren_i(0), nChildren_i(0), action_i(action), isLeaf_i(true),
+        nVisits_i(0), totValue_i(0), gamma_i(inGamma), rand_i(inRand)
+   {}
+
+public:
+
+   /**
+    * Construct a new VarTreeNode root node.
+    * @param[in] inGamma discount factor for future rewards.
+    * @param[in] inRand a uniform random number generated used for selection and
+    * rollout.
+    */
+   VarTreeNode(double inGamma=DEFAULT_GAMMA,URand inRand=URand())
+      : vChildren_i(0), nChildren_i(0), action_i(NO_ACTION), isLeaf_i(true),
+        nVisits_i(0), totValue_i(0), gamma_i(inGamma), rand_i(inRand)
+   {}
+
+   /**
+    * Copy constructor. Performs a deep copy, including all children.
+    * @param[in] tree the tree to copy.
+    */
+   VarTreeNode(const VarTreeNode& tree)
+      : vChildren_i(0), nChildren_i(0), action_i(tree.action_i),
+        isLeaf_i(tree.isLeaf_i), nVisits_i(tree.nVisits_i),
+        totValue_i(tree.totValue_i), gamma_i(tree.gamma_i),
+        rand_i(tree.rand_i)
+   {
+      copyChildren(tree);
+   }
+
+   /**
+    * Copy assignment. Performs a deep copy, including all children.
+    * @param[in] tree the tree to copy.
+    */
+   VarTreeNode& operator=(const VarTreeNode& tree)
+   {
+      if(this==&tree)
+      {
+         return *this;
+      }
+      releaseChildren();
+      action_i = tree.action_i;
+      isLeaf_i = tree.isLeaf_i;
+      nVisits_i = tree.nVisits_i;
+      totValue_i = tree.totValue_i;
+      gamma_i = tree.gamma_i;
+      rand_i = tree.rand_i;
+      copyChildren(tree);
+      return *this;
+   }
+
+   /**
+    * Returns true iff this is a leaf node which has not yet been expanded.
+    */
+   bool isLeaf() const
+   {
+      return isLeaf_i;
+   }
+
+   /**
+    * Returns the number of children of this node, which is the number of
+    * actions that were legal when it was expanded.
+    */
+   int numOfChildren() const
+   {
+      return nChildren_i;
+   }
+
+   /**
+    * Returns the action which leads to a given child.
+    * @param[in] child index of the child, between 0 and numOfChildren().
+    */
+   int childAction(int child) const
+   {
+      assert(0<=child);
+      assert(nChildren_i>child);
+      return vChildren_i[child].action_i;
+   }
+
+   /**
+    * Performs one iteration of the MCTS algorithm, taking this to be the root
+    * node.
+    * @param[in] mdp generator which returns a reward for a given action, and
+    * provides the legal actions in its current state.
+    * @post the depth of the current best path from this node to the top of
+    * the tree will be expanded by one, unless it ends in a terminal state.
+    * The value of all nodes along this path will also be updated.
+    */
+   template<class Generator> void iterate(Generator mdp)
+   {
+      //***********************************************************************
+      // Transverse the tree and expand the leaf at the end of the path.
+      //***********************************************************************
+      std::stack<VarTreeNode*> visited;
+      std::stack<double> rewards;
+      std::vector<int> legal;
+      double value = 0.0;
+
+      //***********************************************************************
+      // Estimate the value of the new leaf using the rollout policy, unless
+      // it is terminal, in which case its value is 0.
+      //***********************************************************************
+      if(!selectPath(mdp,visited,rewards,legal))
+      {
+         double discount = 1.0;
+         value = rollOut(mdp,MAX_ROLLOUT_ITERATIONS,discount,legal);
+      }
+
+      //***********************************************************************
+      // Update the statistics for each node along the path using the
+      // discounted value.
+      //***********************************************************************
+      while(!visited.empty())
+      {
+         assert(visited.size()==rewards.size());
+         value = rewards.top() + gamma_i*value;
+         visited.top()->updateStats(value);
+         visited.pop();
+         rewards.pop();
+      }
+
+   } // iterate
+
+   /**
+    * Performs one iteration of the MCTS algorithm, estimating the value of
+    * the new leaf using an evaluator queue, such as mcts::LeafEvalQueue.
+    * This behaves as UCTreeNode::iterate(Generator,EvalQueue&,int), except
+    * that leaves in a terminal state are backed up immediately with value 0.
+    * @param[in] mdp the generator.
+    * @param[in] queue the queue used to evaluate the leaf.
+    * @param[in] rolloutSteps the number of random rollout steps performed
+    * before the leaf is submitted to the queue.
+    */
+   template<class Generator, class EvalQueue> void iterate
+   (
+    Generator mdp,
+    EvalQueue& queue,
+    int rolloutSteps=0
+   )
+   {
+      //***********************************************************************
+      // Select and expand a leaf, and apply virtual loss to its path, while
+      // holding the tree lock.
+      //***********************************************************************
+      std::stack<VarTreeNode*> visited;
+      std::stack<double> rewards;
+      std::vector<int> legal;
+      std::unique_lock<std::mutex> lock(queue.treeMutex());
+      bool terminal = selectPath(mdp,visited,rewards,legal);
+      PendingPath<VarTreeNode> pending(std::move(visited),std::move(rewards),
+         gamma_i,queue.virtualLoss());
+      lock.unlock();
+
+      //***********************************************************************
+      // Perform any rollout steps without the lock, drawing actions from
+      // this thread's own random number generator. The rollout may also
+      // reach a terminal state.
+      //***********************************************************************
+      if(!terminal)
+      {
+         double discount = 1.0;
+         double partial = rollOut(mdp,rolloutSteps,discount,legal,
+            threadRand<URand>());
+         pending.setRollout(partial,discount);
+         terminal = (0.0==discount);
+      }
+
+      //***********************************************************************
+      // Back up the value, either now (for terminal states, whose value is
+      // 0) or when it has been evaluated by the queue.
+      //***********************************************************************
+      if(terminal)
+      {
+         lock.lock();
+         pending(0.0);
+         return;
+      }
+      queue.submit(mdp,pending);
+
+   } // iterate
+
+   /**
+    * Returns the current best action for the next step.
+    * @returns the best action, or mcts::NO_ACTION if this node has no
+    * children.
+    */
+   int bestAction()
+   {
+      //***********************************************************************
+      // Initialise the selected action, and the best value found so far to
+      // its lowest possible value.
+      //***********************************************************************
+      int selected = NO_ACTION;
+      double bestValue = -std::numeric_limits<double>::max();
+
+      //***********************************************************************
+      // Choose the child with the highest expected value, breaking ties
+      // at random.
+      //***********************************************************************
+      for(int k=0; k<nChildren_i; ++k)
+      {
+         const VarTreeNode& cur = vChildren_i[k];
+         double expValue = cur.totValue_i / (cur.nVisits_i + EPSILON);
+         expValue += rand_i()*EPSILON;
+         if (expValue >= bestValue)
+         {
+            selected = cur.action_i;
+            bestValue = expValue;
+         }
+      }
+      return selected;
+
+   } // bestAction
+
+   /**
+    * Returns the number of times this node has been visited.
+    */
+   double numOfVisits() const
+   {
+      return nVisits_i;
+   }
+
+   /**
+    * Returns the expected value for this tree.
+    */
+   double vValue() const
+   {
+      return totValue_i/nVisits_i;
+   }
+
+   /**
+    * Returns the Q-value for a given child.
+    * @param[in] child index of the child, between 0 and numOfChildren().
+    */
+   double qValue(int child) const
+   {
+      assert(0<=child);
+      assert(nChildren_i>child);
+      return vChildren_i[child].vValue();
+   }
+
+   /**
+    * Counts the number of nodes in the tree with this node as its root.
+    */
+   int numOfNodes() const
+   {
+      int result = 1;
+      for(int k=0; k<nChildren_i; ++k)
+      {
+         result += vChildren_i[k].numOfNodes();
+      }
+      return result;
+   }
+
+   /**
+    * Returns the maximum depth of the tree with this node as its root.
+    * @param[in] parentDepth depth of parent node.
+    * @see UCTreeNode::maxDepth
+    */
+   int maxDepth(int parentDepth=0) const
+   {
+      int maxDepth = parentDepth + 1;
+      for(int k=0; k<nChildren_i; ++k)
+      {
+         int curDepth = vChildren_i[k].maxDepth(parentDepth+1);
+         if(maxDepth < curDepth)
+         {
+            maxDepth = curDepth;
+         }
+      }
+      return maxDepth;
+   }
+
+   /**
+    * Destructor deletes all child nodes in addition to this one.
+    */
+   ~VarTreeNode()
+   {
+      releaseChildren();
+   }
+
+}; // class VarTreeNode
+
+/**
+ * Produces a string representation of a VarTreeNode for diagnostic purposes.
+ * Prints the vValue, and the qValue for each legal action.
+ */
+template<class URand, class Storage> std::ostream& operator<<
+(
+ std::ostream& out,
+ const VarTreeNode<URand,Storage>& tree
+)
+{
+   out << "[V=" << tree.vValue();
+   for(int k=0; k<tree.numOfChildren(); ++k)
+   {
+      out << ",Q" << tree.childAction(k) << '=' << tree.qValue(k);
+   }
+   out << ']';
+   return out;
+
+} // operator <<
+
+} // namespace mcts
+
+#endif // MCTS_VARTREENODE_H
@@ -0,0 +1,244 @@
+/**
+ * @file arenaHarness.cpp
+ * Test harness for trees allocated from node arenas.
+ */
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "TreeNode.h"
+#include "VarTreeNode.h"
+#include "NodeArena.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+/**
+ * Simple uniform random number generator for testing purposes.
+ */
+struct SimpleBandit_m
+{
+   double operator()(int action)
+   {
+      return static_cast<double>(rand()%RAND_MAX)/RAND_MAX;
+   }
+
+   void legalActions(std::vector<int>& actions) const
+   {
+      actions.clear();
+      for(int k=0; k<1+rand()%5; ++k)
+      {
+         actions.push_back(k);
+      }
+   }
+};
+
+struct TestTag_m {};
+
+typedef mcts::ArenaStorage<TestTag_m> Storage_m;
+
+const int N_ACTIONS = 4;
+
+typedef mcts::UCTreeNode<N_ACTIONS,mcts::SimpleURand,Storage_m> Tree_m;
+
+struct OtherTag_m {};
+
+typedef mcts::ArenaStorage<OtherTag_m> OtherStorage_m;
+
+typedef mcts::UCTreeNode<N_ACTIONS,mcts::SimpleURand,OtherStorage_m>
+   OtherTree_m;
+
+/**
+ * Grows a tree by a number of iterations.
+ */
+void grow(Tree_m* pTree, int nIterations)
+{
+   SimpleBandit_m bandit;
+   for(int k=0; k<nIterations; ++k)
+   {
+      pTree->iterate(bandit);
+   }
+}
+
+/**
+ * Grows two trees using different pools, alternating between them on every
+ * iteration.
+ */
+void growBoth(Tree_m* pTree, OtherTree_m* pOther, int nIterations)
+{
+   SimpleBandit_m bandit;
+   for(int k=0; k<nIterations; ++k)
+   {
+      pTree->iterate(bandit);
+      pOther->iterate(bandit);
+   }
+}
+
+/**
+ * Checks that a tree has the expected number of nodes.
+ */
+bool checkNodes(const Tree_m& tree, int nIterations)
+{
+   const int EXP_N_NODES = 1 + N_ACTIONS*nIterations;
+   if(EXP_N_NODES != tree.numOfNodes())
+   {
+      std::cout << "Unexpected number of nodes: " << tree.numOfNodes() <<
+         " should be: " << EXP_N_NODES << std::endl;
+      return false;
+   }
+   return true;
+}
+
+} // module namespace
+
+/**
+ * Test harness for arena storage.
+ */
+int main()
+{
+   try
+   {
+      std::srand(std::time(0));
+      const int N_ITERATIONS = 1000;
+      const int N_THREADS = 4;
+
+      //************************************************************************
+      // Try each page mode in turn. Explicit huge pages may not be available,
+      // in which case the arena should silently fall back to normal pages.
+      // These are also tried with chunks smaller and larger than a typical
+      // huge page, which must either fall back or stay chunk aligned.
+      //************************************************************************
+      const int N_MODES = 5;
+      const mcts::PageMode MODES[N_MODES] = { mcts::NORMAL_PAGES,
+         mcts::TRANSPARENT_HUGE_PAGES, mcts::EXPLICIT_HUGE_PAGES,
+         mcts::EXPLICIT_HUGE_PAGES, mcts::EXPLICIT_HUGE_PAGES };
+      const std::size_t CHUNK_SIZES[N_MODES] = {
+         mcts::DEFAULT_ARENA_CHUNK_SIZE, mcts::DEFAULT_ARENA_CHUNK_SIZE,
+         mcts::DEFAULT_ARENA_CHUNK_SIZE, std::size_t(1) << 20,
+         std::size_t(4) << 20 };
+      for(int m=0; m<N_MODES; ++m)
+      {
+         Storage_m::configure(mcts::ArenaOptions(mcts::ARENA_PER_THREAD,
+            MODES[m],true,CHUNK_SIZES[m]));
+
+         //*********************************************************************
+         // Grow several trees concurrently, then copy and destroy one on
+         // a different thread from the one which allocated its nodes.
+         //*********************************************************************
+         std::vector<Tree_m*> trees;
+         std::vector<std::thread> threads;
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            trees.push_back(new Tree_m());
+            threads.push_back(std::thread(grow,trees.back(),N_ITERATIONS));
+         }
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            threads[k].join();
+            if(!checkNodes(*trees[k],N_ITERATIONS))
+            {
+               return EXIT_FAILURE;
+            }
+         }
+
+         Tree_m copy(*trees[0]);
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            delete trees[k];
+         }
+         grow(&copy,N_ITERATIONS);
+         if(!checkNodes(copy,2*N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+
+         mcts::ArenaStats stats = Storage_m::pool().stats();
+         std::cout << "mode: " << MODES[m] << " chunk size: " <<
+            CHUNK_SIZES[m] << " arenas: " << stats.nArenas <<
+            " chunks: " << stats.nChunks << " explicit huge: " <<
+            stats.nHugeChunks << " numa bound: " << stats.nBoundChunks <<
+            " numa nodes: " << stats.nNumaNodes << std::endl;
+         if(N_THREADS+1 != stats.nArenas)
+         {
+            std::cout << "Expected one arena per thread" << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Two pools used alternately by the same threads. Each thread should
+      // keep using its own arena in each pool.
+      //************************************************************************
+      {
+         Storage_m::configure(mcts::ArenaOptions(mcts::ARENA_PER_THREAD));
+         OtherStorage_m::configure(mcts::ArenaOptions(mcts::ARENA_PER_THREAD));
+         std::vector<Tree_m*> trees;
+         std::vector<OtherTree_m*> others;
+         std::vector<std::thread> threads;
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            trees.push_back(new Tree_m());
+            others.push_back(new OtherTree_m());
+            threads.push_back(std::thread(growBoth,trees.back(),
+               others.back(),N_ITERATIONS));
+         }
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            threads[k].join();
+            if(!checkNodes(*trees[k],N_ITERATIONS) ||
+               1+N_ACTIONS*N_ITERATIONS != others[k]->numOfNodes())
+            {
+               return EXIT_FAILURE;
+            }
+         }
+         const int N_ARENAS = Storage_m::pool().stats().nArenas;
+         const int N_OTHER_ARENAS = OtherStorage_m::pool().stats().nArenas;
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            delete trees[k];
+            delete others[k];
+         }
+         if(N_THREADS != N_ARENAS || N_THREADS != N_OTHER_ARENAS)
+         {
+            std::cout << "Expected one arena per thread in each pool: " <<
+               N_ARENAS << " " << N_OTHER_ARENAS << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Shared per-NUMA-node arenas, used by variable size trees.
+      //************************************************************************
+      Storage_m::configure(mcts::ArenaOptions(mcts::ARENA_PER_NUMA_NODE));
+      {
+         mcts::VarTreeNode<mcts::SimpleURand,Storage_m> tree;
+         SimpleBandit_m bandit;
+         for(int k=0; k<N_ITERATIONS; ++k)
+         {
+            tree.iterate(bandit);
+         }
+         std::cout << "var tree: " << tree << std::endl;
+      }
+      mcts::ArenaStats stats = Storage_m::pool().stats();
+      if(stats.nNumaNodes < stats.nArenas)
+      {
+         std::cout << "Expected at most one arena per NUMA node" << std::endl;
+         return EXIT_FAILURE;
+      }
+
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   //***************************************************************************
+   // Return sucessfully
+   //***************************************************************************
+   return EXIT_SUCCESS;
+}
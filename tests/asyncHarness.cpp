@@ -0,0 +1,333 @@
+/**
+ * @file asyncHarness.cpp
+ * Test harness for asynchronous MCTS iterations using a simulator process.
+ *
+ * Usage: asyncHarness path/to/simServer
+ */
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "TreeNode.h"
+#include "AsyncSearch.h"
+#include "SimulatorClient.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+const int N_ACTIONS = 4;
+
+typedef mcts::UCTreeNode<N_ACTIONS> Tree_m;
+
+/**
+ * Event loop which completes every waiting step with the same reward each
+ * time it is polled, except for one chosen step, which fails.
+ */
+class ManualLoop_m
+{
+private:
+
+   std::vector<std::coroutine_handle<> > waiting_i;
+   int nSteps_i;
+   int failAt_i;
+
+public:
+
+   /**
+    * Awaitable returned by ManualGenerator_m::step.
+    */
+   struct Step
+   {
+      ManualLoop_m* pLoop;
+
+      bool await_ready() const
+      {
+         return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> handle)
+      {
+         pLoop->waiting_i.push_back(handle);
+      }
+
+      double await_resume() const
+      {
+         if(++pLoop->nSteps_i == pLoop->failAt_i)
+         {
+            throw std::runtime_error("step failed");
+         }
+         return 0.5;
+      }
+   };
+
+   /**
+    * Constructs a loop whose <tt>failAt</tt>th completed step fails.
+    */
+   ManualLoop_m(int failAt) : nSteps_i(0), failAt_i(failAt) {}
+
+   /**
+    * Completes every step waiting when this is called.
+    */
+   void poll()
+   {
+      std::vector<std::coroutine_handle<> > ready;
+      ready.swap(waiting_i);
+      for(std::size_t k=0; k<ready.size(); ++k)
+      {
+         ready[k].resume();
+      }
+   }
+
+   /**
+    * Returns the number of steps waiting to be completed.
+    */
+   int numWaiting() const
+   {
+      return waiting_i.size();
+   }
+};
+
+/**
+ * Generator whose steps are completed by a ManualLoop_m.
+ */
+struct ManualGenerator_m
+{
+   ManualLoop_m* pLoop;
+
+   ManualLoop_m::Step step(int action)
+   {
+      ManualLoop_m::Step awaiter = { pLoop };
+      return awaiter;
+   }
+};
+
+/**
+ * Checks that a tree has the expected size, and that no virtual loss remains.
+ * @returns true iff all checks pass.
+ */
+bool checkTree(const Tree_m& tree, int nIterations)
+{
+   std::cout << "tree: " << tree << std::endl;
+   const int EXP_N_NODES = 1 + N_ACTIONS*nIterations;
+   if(EXP_N_NODES != tree.numOfNodes())
+   {
+      std::cout << "Unexpected number of nodes: " << tree.numOfNodes() <<
+         " should be: " << EXP_N_NODES << std::endl;
+      return false;
+   }
+   if(nIterations != tree.numOfVisits())
+   {
+      std::cout << "Unexpected number of root visits: " <<
+         tree.numOfVisits() << std::endl;
+      return false;
+   }
+
+   //***************************************************************************
+   // All rewards are non-negative, so negative values imply that some
+   // virtual loss has not been reverted.
+   //***************************************************************************
+   for(int k=0; k<N_ACTIONS; ++k)
+   {
+      if(0 > tree.qValue(k))
+      {
+         std::cout << "Virtual loss not reverted for action " << k <<
+            std::endl;
+         return false;
+      }
+   }
+   return true;
+
+} // checkTree
+
+} // module namespace
+
+/**
+ * Test harness for UCTreeNode::iterateAsync and mcts::searchAsync.
+ */
+int main(int argc, char* argv[])
+{
+   if(2>argc)
+   {
+      std::cout << "Usage: " << argv[0] << " path/to/simServer" << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   try
+   {
+      std::vector<std::string> args;
+      args.push_back("1.0"); // latency in ms
+      mcts::SimulatorClient client(argv[1],args);
+
+      //************************************************************************
+      // Iterations which fail, or are destroyed while suspended, should leave
+      // no trace in the tree's statistics, so the root should only count
+      // visits from those that completed.
+      //************************************************************************
+      {
+         const int N_TASKS = 20;
+         const int N_POLLS = 8;
+         ManualLoop_m loop(30);
+         ManualGenerator_m mdp = { &loop };
+         Tree_m tree;
+         std::vector<mcts::AsyncTask> tasks;
+         for(int k=0; k<N_TASKS; ++k)
+         {
+            tasks.push_back(tree.iterateAsync(mdp,5));
+            tasks.back().start();
+         }
+         for(int k=0; k<N_POLLS; ++k)
+         {
+            loop.poll();
+         }
+
+         int nCompleted = 0;
+         int nFailed = 0;
+         for(int k=0; k<N_TASKS; ++k)
+         {
+            if(!tasks[k].done())
+            {
+               continue;
+            }
+            try
+            {
+               tasks[k].rethrowIfFailed();
+               ++nCompleted;
+            }
+            catch(std::runtime_error&)
+            {
+               ++nFailed;
+            }
+         }
+         const int N_DESTROYED = loop.numWaiting();
+         tasks.clear();
+
+         std::cout << "completed: " << nCompleted << " failed: " << nFailed <<
+            " destroyed: " << N_DESTROYED << std::endl;
+         if(1!=nFailed || 0==nCompleted || 0==N_DESTROYED)
+         {
+            std::cout << "Expected completed, failed and destroyed "
+               "iterations" << std::endl;
+            return EXIT_FAILURE;
+         }
+         if(nCompleted != tree.numOfVisits())
+         {
+            std::cout << "Unexpected number of root visits: " <<
+               tree.numOfVisits() << " should be: " << nCompleted << std::endl;
+            return EXIT_FAILURE;
+         }
+         for(int k=0; k<N_ACTIONS; ++k)
+         {
+            if(0 > tree.qValue(k))
+            {
+               std::cout << "Virtual loss not removed for action " << k <<
+                  std::endl;
+               return EXIT_FAILURE;
+            }
+         }
+      }
+
+      //************************************************************************
+      // Destroying a client must not wait for simulators started later by
+      // other clients, which previously inherited its end of the connection.
+      //************************************************************************
+      {
+         mcts::SimulatorClient* pFirst =
+            new mcts::SimulatorClient(argv[1],args);
+         mcts::SimulatorClient second(argv[1],args);
+         pFirst->call(pFirst->openSession(),0);
+         second.call(second.openSession(),0);
+         delete pFirst;
+      }
+
+      //************************************************************************
+      // Copying a generator should fork its simulator state. With no noise,
+      // rewards depend only on the state and action, so a fork should earn
+      // the same reward as the original, and a new session a different one.
+      //************************************************************************
+      {
+         std::vector<std::string> exactArgs;
+         exactArgs.push_back("0"); // latency in ms
+         exactArgs.push_back("1"); // seed
+         exactArgs.push_back("0"); // noise
+         mcts::SimulatorClient exact(argv[1],exactArgs);
+         mcts::BlockingSimGenerator original(exact);
+         original(3);
+         mcts::BlockingSimGenerator forked(original);
+         mcts::BlockingSimGenerator fresh(exact);
+         const double ORIGINAL = original(0);
+         const double FORKED = forked(0);
+         const double FRESH = fresh(0);
+         std::cout << "rewards: original " << ORIGINAL << " forked " <<
+            FORKED << " fresh " << FRESH << std::endl;
+         if(ORIGINAL != FORKED || ORIGINAL == FRESH)
+         {
+            std::cout << "Simulator state not forked" << std::endl;
+            return EXIT_FAILURE;
+         }
+         if(3 != exact.numSessions())
+         {
+            std::cout << "Unexpected number of sessions" << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Blocking iterations through the simulator.
+      //************************************************************************
+      {
+         const int N_ITERATIONS = 5;
+         Tree_m tree;
+         mcts::BlockingSimGenerator mdp(client);
+         for(int k=0; k<N_ITERATIONS; ++k)
+         {
+            tree.iterate(mdp);
+         }
+         if(!checkTree(tree,N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Many asynchronous iterations in flight at once.
+      //************************************************************************
+      {
+         const int N_ITERATIONS = 500;
+         const int MAX_IN_FLIGHT = 100;
+         Tree_m tree;
+         mcts::AsyncSimGenerator mdp(client);
+         mcts::searchAsync(tree,mdp,client,N_ITERATIONS,MAX_IN_FLIGHT);
+         if(0 != client.numPending())
+         {
+            std::cout << "Requests still pending" << std::endl;
+            return EXIT_FAILURE;
+         }
+         if(1 != client.numSessions())
+         {
+            std::cout << "Iterations did not close their sessions" <<
+               std::endl;
+            return EXIT_FAILURE;
+         }
+         if(!checkTree(tree,N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   //***************************************************************************
+   // Return sucessfully
+   //***************************************************************************
+   return EXIT_SUCCESS;
+}
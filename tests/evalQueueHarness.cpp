@@ -0,0 +1,263 @@
+/**
+ * @file evalQueueHarness.cpp
+ * Test harness for MCTS using a batched leaf evaluator queue.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "TreeNode.h"
+#include "LeafEvalQueue.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+/**
+ * Simple uniform random number generator for testing purposes.
+ */
+struct SimpleBandit_m
+{
+   /**
+    * Generates uniform random numbers in the range [0,1).
+    */
+   double operator()(int action)
+   {
+      return static_cast<double>(rand()%RAND_MAX)/RAND_MAX;
+   }
+};
+
+/**
+ * Number of threads currently inside ConstModel_m.
+ */
+std::atomic<int> nInModel_m(0);
+
+/**
+ * Set if ConstModel_m is ever called by two threads at once.
+ */
+std::atomic<bool> isOverlapped_m(false);
+
+/**
+ * Value model which assigns the same value to every leaf, and records
+ * whether it is ever called concurrently.
+ */
+struct ConstModel_m
+{
+   void operator()
+   (
+    const std::vector<SimpleBandit_m>& leaves,
+    std::vector<double>& values
+   )
+   {
+      if(0 < nInModel_m++)
+      {
+         isOverlapped_m = true;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+      for(std::size_t k=0; k<leaves.size(); ++k)
+      {
+         values[k] = 0.5;
+      }
+      --nInModel_m;
+   }
+};
+
+typedef mcts::LeafEvalQueue<SimpleBandit_m,ConstModel_m> Queue_m;
+
+const int N_ACTIONS = 4;
+
+typedef mcts::UCTreeNode<N_ACTIONS> Tree_m;
+
+/**
+ * Checks that a tree has the expected size and that no virtual loss remains
+ * after all leaves have been backed up.
+ * @returns true iff all checks pass.
+ */
+bool checkTree(Tree_m& tree, Queue_m& queue, int nIterations)
+{
+   if(0!=queue.numPending())
+   {
+      std::cout << "Leaves still pending in queue" << std::endl;
+      return false;
+   }
+
+   if(isOverlapped_m)
+   {
+      std::cout << "Model called concurrently" << std::endl;
+      return false;
+   }
+
+   const int EXP_N_NODES = 1 + N_ACTIONS*nIterations;
+   if(EXP_N_NODES != tree.numOfNodes())
+   {
+      std::cout << "Unexpected number of nodes: " << tree.numOfNodes() <<
+         " should be: " << EXP_N_NODES << std::endl;
+      return false;
+   }
+
+   if(nIterations != tree.numOfVisits())
+   {
+      std::cout << "Unexpected number of root visits: " <<
+         tree.numOfVisits() << " should be: " << nIterations << std::endl;
+      return false;
+   }
+
+   //***************************************************************************
+   // Every leaf has value 0.5 and rewards lie in [0,1), so if no virtual loss
+   // remains, all values must be non-negative.
+   //***************************************************************************
+   for(int k=0; k<N_ACTIONS; ++k)
+   {
+      if(0 > tree.qValue(k))
+      {
+         std::cout << "Virtual loss not reverted for action " << k <<
+            std::endl;
+         return false;
+      }
+   }
+
+   mcts::EvalQueueStats stats = queue.stats();
+   if(nIterations != stats.nLeaves)
+   {
+      std::cout << "Unexpected number of leaves evaluated: " <<
+         stats.nLeaves << std::endl;
+      return false;
+   }
+
+   std::cout << "tree: " << tree << std::endl;
+   std::cout << "batches: " << stats.nBatches << " fill rate: " <<
+      stats.fillRate() << " mean latency: " << stats.meanLatency() <<
+      " max latency: " << stats.maxLatency << std::endl;
+   return true;
+
+} // checkTree
+
+/**
+ * Performs a number of iterations on a shared tree.
+ */
+void search(Tree_m* pTree, Queue_m* pQueue, int nIterations)
+{
+   SimpleBandit_m bandit;
+   for(int k=0; k<nIterations; ++k)
+   {
+      pTree->iterate(bandit,*pQueue,2);
+   }
+}
+
+} // module namespace
+
+/**
+ * Test harness for batched evaluation in synchronous, asynchronous and
+ * multithreaded modes.
+ */
+int main()
+{
+   try
+   {
+      std::srand(std::time(0));
+      const int N_ITERATIONS = 200;
+      const int BATCH_SIZE = 16;
+
+      //************************************************************************
+      // Single threaded, with batches evaluated synchronously. Since the
+      // timeout is long, all but the last batch should be full.
+      //************************************************************************
+      {
+         Tree_m tree;
+         Queue_m queue(ConstModel_m(),BATCH_SIZE,60.0,false);
+         search(&tree,&queue,N_ITERATIONS);
+         queue.drain();
+         std::cout << "Synchronous:" << std::endl;
+         if(!checkTree(tree,queue,N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+         const int EXP_N_BATCHES = (N_ITERATIONS+BATCH_SIZE-1)/BATCH_SIZE;
+         if(EXP_N_BATCHES != queue.stats().nBatches)
+         {
+            std::cout << "Unexpected number of batches. Should be: " <<
+               EXP_N_BATCHES << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Single threaded, with batches evaluated by the worker thread.
+      //************************************************************************
+      {
+         Tree_m tree;
+         Queue_m queue(ConstModel_m(),BATCH_SIZE,0.001,true);
+         search(&tree,&queue,N_ITERATIONS);
+         queue.drain();
+         std::cout << "Asynchronous:" << std::endl;
+         if(!checkTree(tree,queue,N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // A partial batch should be flushed by the worker once it times out,
+      // without waiting for the batch to fill, or for a call to drain().
+      // The worker is left to go idle first, so that it is waiting for new
+      // leaves when they arrive.
+      //************************************************************************
+      {
+         const int N_PARTIAL = BATCH_SIZE/2;
+         Tree_m tree;
+         Queue_m queue(ConstModel_m(),BATCH_SIZE,0.001,true);
+         std::this_thread::sleep_for(std::chrono::milliseconds(20)); // idle
+         search(&tree,&queue,N_PARTIAL);
+         std::this_thread::sleep_for(std::chrono::milliseconds(200));
+         std::cout << "Timed out:" << std::endl;
+         if(!checkTree(tree,queue,N_PARTIAL))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Several search threads sharing one tree and one queue, with batches
+      // evaluated both by the worker thread, and synchronously by whichever
+      // search thread fills them.
+      //************************************************************************
+      for(int async=1; async>=0; --async)
+      {
+         const int N_THREADS = 4;
+         Tree_m tree;
+         Queue_m queue(ConstModel_m(),BATCH_SIZE,0.001,1==async);
+         std::vector<std::thread> threads;
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            threads.push_back(std::thread(search,&tree,&queue,N_ITERATIONS));
+         }
+         for(int k=0; k<N_THREADS; ++k)
+         {
+            threads[k].join();
+         }
+         queue.drain();
+         std::cout << "Multithreaded " <<
+            (1==async ? "asynchronous:" : "synchronous:") << std::endl;
+         if(!checkTree(tree,queue,N_THREADS*N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   //***************************************************************************
+   // Return sucessfully
+   //***************************************************************************
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,256 @@
+/**
+ * @file forkHarness.cpp
+ * Test harness for copy-on-write tree forks, and move semantics.
+ */
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <utility>
+#include "TreeNode.h"
+#include "TreeReclaimer.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+/**
+ * Simple uniform random number generator for testing purposes.
+ */
+struct SimpleBandit_m
+{
+   double operator()(int action)
+   {
+      return static_cast<double>(rand()%RAND_MAX)/RAND_MAX;
+   }
+};
+
+/**
+ * Storage policy which counts the number of nodes currently allocated.
+ */
+struct CountingStorage_m
+{
+   static long nLive;
+
+   static void* allocate(std::size_t size)
+   {
+      ++nLive;
+      return mcts::HeapStorage::allocate(size);
+   }
+
+   static void deallocate(void* p, std::size_t size)
+   {
+      --nLive;
+      mcts::HeapStorage::deallocate(p,size);
+   }
+};
+
+long CountingStorage_m::nLive = 0;
+
+const int N_ACTIONS = 4;
+
+typedef mcts::UCTreeNode<N_ACTIONS,mcts::SimpleURand,CountingStorage_m>
+   Tree_m;
+
+/**
+ * Grows a tree by a number of iterations.
+ */
+void grow(Tree_m* pTree, int nIterations)
+{
+   SimpleBandit_m bandit;
+   for(int k=0; k<nIterations; ++k)
+   {
+      pTree->iterate(bandit);
+   }
+}
+
+/**
+ * Returns true iff two trees have the same size and root statistics.
+ */
+bool sameRoot(const Tree_m& a, const Tree_m& b)
+{
+   if(a.numOfNodes()!=b.numOfNodes() || a.numOfVisits()!=b.numOfVisits())
+   {
+      return false;
+   }
+   for(int k=0; !a.isLeaf() && k<N_ACTIONS; ++k)
+   {
+      if(a.qValue(k)!=b.qValue(k))
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * Reports a failed check.
+ */
+int fail(const char* message)
+{
+   std::cout << message << std::endl;
+   return EXIT_FAILURE;
+}
+
+} // module namespace
+
+/**
+ * Test harness for UCTreeNode::fork and related members.
+ */
+int main()
+{
+   try
+   {
+      std::srand(std::time(0));
+      const int N_ITERATIONS = 200;
+
+      {
+         //*********************************************************************
+         // Forking should not allocate any nodes.
+         //*********************************************************************
+         Tree_m tree;
+         grow(&tree,N_ITERATIONS);
+         const long N_ALLOCATED = CountingStorage_m::nLive;
+         Tree_m fork = tree.fork();
+         if(N_ALLOCATED!=CountingStorage_m::nLive || !sameRoot(tree,fork))
+         {
+            return fail("Fork is not an identical shallow copy");
+         }
+
+         //*********************************************************************
+         // Each iteration of the fork should copy only the nodes on its path,
+         // and should not affect the original tree.
+         //*********************************************************************
+         Tree_m before(tree);
+         const long N_BEFORE = CountingStorage_m::nLive;
+         grow(&fork,1);
+         const long N_COPIED = CountingStorage_m::nLive - N_BEFORE - N_ACTIONS;
+         std::cout << "nodes copied by first iteration of fork: " <<
+            N_COPIED << " depth: " << tree.maxDepth() << std::endl;
+         if(N_COPIED > tree.maxDepth())
+         {
+            return fail("Fork copied nodes off its path");
+         }
+         grow(&fork,N_ITERATIONS);
+         if(!sameRoot(tree,before))
+         {
+            return fail("Iterating the fork changed the original");
+         }
+         if(fork.numOfNodes()!=1+N_ACTIONS*(2*N_ITERATIONS+1))
+         {
+            return fail("Unexpected number of nodes in fork");
+         }
+
+         //*********************************************************************
+         // Iterating the original should not affect the fork, and the fork
+         // should outlive the original.
+         //*********************************************************************
+         Tree_m forkBefore(fork);
+         grow(&tree,N_ITERATIONS);
+         if(!sameRoot(fork,forkBefore))
+         {
+            return fail("Iterating the original changed the fork");
+         }
+         tree = Tree_m();
+         if(!sameRoot(fork,forkBefore))
+         {
+            return fail("Destroying the original changed the fork");
+         }
+
+         //*********************************************************************
+         // Moving should transfer ownership without allocating.
+         //*********************************************************************
+         const long N_LIVE = CountingStorage_m::nLive;
+         Tree_m moved(std::move(fork));
+         if(N_LIVE!=CountingStorage_m::nLive || 1!=fork.numOfNodes() ||
+            !sameRoot(moved,forkBefore))
+         {
+            return fail("Move construction copied nodes");
+         }
+         fork = std::move(moved);
+         if(N_LIVE!=CountingStorage_m::nLive || 1!=moved.numOfNodes() ||
+            !sameRoot(fork,forkBefore))
+         {
+            return fail("Move assignment copied nodes");
+         }
+
+         //*********************************************************************
+         // Copy assignment should deep copy, and survive self assignment.
+         //*********************************************************************
+         Tree_m& alias = fork;
+         fork = alias;
+         moved = fork;
+         grow(&moved,N_ITERATIONS);
+         if(!sameRoot(fork,forkBefore))
+         {
+            return fail("Copy assignment is not independent of original");
+         }
+
+         //*********************************************************************
+         // Advancing a fork should not destroy nodes shared with the other.
+         //*********************************************************************
+         Tree_m other = fork.fork();
+         {
+            mcts::TreeReclaimer<Tree_m> reclaimer;
+            other.advance(other.bestAction(),reclaimer);
+         }
+         if(!sameRoot(fork,forkBefore))
+         {
+            return fail("Advancing a fork changed the original");
+         }
+         grow(&other,N_ITERATIONS);
+      }
+
+      //************************************************************************
+      // Every node should have been released by now.
+      //************************************************************************
+      if(0!=CountingStorage_m::nLive)
+      {
+         std::cout << "Leaked nodes: " << CountingStorage_m::nLive <<
+            std::endl;
+         return EXIT_FAILURE;
+      }
+
+      //************************************************************************
+      // Forks can be searched concurrently by different threads.
+      //************************************************************************
+      {
+         mcts::UCTreeNode<N_ACTIONS> tree;
+         for(int k=0; k<N_ITERATIONS; ++k)
+         {
+            tree.iterate(SimpleBandit_m());
+         }
+         mcts::UCTreeNode<N_ACTIONS> fork = tree.fork();
+         std::thread thread([&fork,N_ITERATIONS]()
+         {
+            for(int k=0; k<N_ITERATIONS; ++k)
+            {
+               fork.iterate(SimpleBandit_m());
+            }
+         });
+         for(int k=0; k<N_ITERATIONS; ++k)
+         {
+            tree.iterate(SimpleBandit_m());
+         }
+         thread.join();
+         const int EXP_N_NODES = 1 + 2*N_ACTIONS*N_ITERATIONS;
+         if(EXP_N_NODES!=tree.numOfNodes() || EXP_N_NODES!=fork.numOfNodes())
+         {
+            return fail("Unexpected number of nodes after concurrent search");
+         }
+      }
+
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   //***************************************************************************
+   // Return sucessfully
+   //***************************************************************************
+   return EXIT_SUCCESS;
+}
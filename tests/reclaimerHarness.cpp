@@ -0,0 +1,262 @@
+/**
+ * @file reclaimerHarness.cpp
+ * Test harness for deferred destruction of discarded subtrees.
+ */
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "LeafEvalQueue.h"
+#include "TreeNode.h"
+#include "TreeReclaimer.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+/**
+ * Simple uniform random number generator for testing purposes.
+ */
+struct SimpleBandit_m
+{
+   double operator()(int action)
+   {
+      return static_cast<double>(rand()%RAND_MAX)/RAND_MAX;
+   }
+};
+
+const int N_ACTIONS = 4;
+
+typedef mcts::UCTreeNode<N_ACTIONS> Tree_m;
+
+typedef mcts::TreeReclaimer<Tree_m> Reclaimer_m;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Value model which assigns the same value to every leaf.
+ */
+struct ConstModel_m
+{
+   void operator()
+   (
+    const std::vector<SimpleBandit_m>& leaves,
+    std::vector<double>& values
+   )
+   {
+      for(std::size_t k=0; k<leaves.size(); ++k)
+      {
+         values[k] = 0.5;
+      }
+   }
+};
+
+typedef mcts::LeafEvalQueue<SimpleBandit_m,ConstModel_m> Queue_m;
+
+/**
+ * Grows a tree by a number of iterations.
+ */
+void grow(Tree_m& tree, int nIterations)
+{
+   SimpleBandit_m bandit;
+   for(int k=0; k<nIterations; ++k)
+   {
+      tree.iterate(bandit);
+   }
+}
+
+/**
+ * Advances a tree by its best action, then prunes what remains, checking
+ * that the reclaimer destroys exactly the discarded nodes.
+ * @returns true iff all checks pass.
+ */
+bool checkAdvanceAndPrune(Tree_m& tree, Reclaimer_m& reclaimer)
+{
+   //***************************************************************************
+   // Advancing should keep only the chosen subtree. The chosen child itself
+   // is destroyed immediately, rather than by the reclaimer.
+   //***************************************************************************
+   const int N_NODES = tree.numOfNodes();
+   Clock::time_point start = Clock::now();
+   tree.advance(tree.bestAction(),reclaimer);
+   double advanceTime = std::chrono::duration<double>
+      (Clock::now()-start).count();
+   const int N_KEPT = tree.numOfNodes();
+   reclaimer.drain();
+
+   mcts::ReclaimStats stats = reclaimer.stats();
+   std::cout << "advance took " << advanceTime << "s, kept " << N_KEPT <<
+      " of " << N_NODES << " nodes, freed " << stats.nFreed <<
+      ", max pending " << stats.maxPending << std::endl;
+   if(N_NODES-1-N_KEPT != stats.nFreed || 0 != stats.nPending)
+   {
+      std::cout << "Unexpected number of nodes freed. Should be: " <<
+         N_NODES-1-N_KEPT << std::endl;
+      return false;
+   }
+
+   //***************************************************************************
+   // Pruning should leave only the root.
+   //***************************************************************************
+   tree.prune(reclaimer);
+   reclaimer.drain();
+   stats = reclaimer.stats();
+   if(1!=tree.numOfNodes() || N_NODES-2 != stats.nFreed)
+   {
+      std::cout << "Unexpected number of nodes after pruning" << std::endl;
+      return false;
+   }
+   return true;
+
+} // checkAdvanceAndPrune
+
+} // module namespace
+
+/**
+ * Test harness for TreeReclaimer.
+ */
+int main()
+{
+   try
+   {
+      std::srand(std::time(0));
+      const int N_ITERATIONS = 5000;
+
+      //************************************************************************
+      // Time a normal recursive destructor for comparison.
+      //************************************************************************
+      {
+         Tree_m* pTree = new Tree_m();
+         grow(*pTree,N_ITERATIONS);
+         Clock::time_point start = Clock::now();
+         delete pTree;
+         std::cout << "recursive destructor took " <<
+            std::chrono::duration<double>(Clock::now()-start).count() <<
+            "s" << std::endl;
+      }
+
+      //************************************************************************
+      // Asynchronous, without a rate limit.
+      //************************************************************************
+      {
+         Reclaimer_m reclaimer;
+         Tree_m tree;
+         grow(tree,N_ITERATIONS);
+         if(!checkAdvanceAndPrune(tree,reclaimer))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Grown through an asynchronous evaluation queue. The queue holds raw
+      // pointers to the paths of pending leaves, so it must be drained
+      // before any subtree is handed to the reclaimer.
+      //************************************************************************
+      {
+         Reclaimer_m reclaimer;
+         Queue_m queue(ConstModel_m(),mcts::DEFAULT_EVAL_BATCH_SIZE,0.001,
+            true);
+         Tree_m tree;
+         SimpleBandit_m bandit;
+         for(int k=0; k<N_ITERATIONS; ++k)
+         {
+            tree.iterate(bandit,queue,1);
+         }
+         queue.drain();
+         if(N_ITERATIONS != queue.stats().nLeaves)
+         {
+            std::cout << "Leaves still pending in queue" << std::endl;
+            return EXIT_FAILURE;
+         }
+         if(!checkAdvanceAndPrune(tree,reclaimer))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // With a rate limit, the background thread should take at least
+      // nFreed/MAX_RATE seconds. We can't use drain() here, since it ignores
+      // the rate limit, so we wait for the backlog to empty instead.
+      //************************************************************************
+      {
+         const double MAX_RATE = 1e5;
+         const int BATCH_SIZE = 64;
+         Reclaimer_m reclaimer(true,MAX_RATE,BATCH_SIZE);
+         Tree_m tree;
+         grow(tree,N_ITERATIONS);
+         Clock::time_point start = Clock::now();
+         tree.prune(reclaimer);
+         while(0 < reclaimer.stats().nPending)
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+         }
+         double time = std::chrono::duration<double>
+            (Clock::now()-start).count();
+         mcts::ReclaimStats stats = reclaimer.stats();
+         const double MIN_TIME = (stats.nFreed-BATCH_SIZE)/MAX_RATE;
+         std::cout << "rate limited reclaim of " << stats.nFreed <<
+            " nodes took " << time << "s, minimum " << MIN_TIME << "s" <<
+            std::endl;
+         if(N_ACTIONS*N_ITERATIONS != stats.nFreed)
+         {
+            std::cout << "Unexpected number of nodes freed" << std::endl;
+            return EXIT_FAILURE;
+         }
+         if(0.9*MIN_TIME > time)
+         {
+            std::cout << "Rate limit exceeded" << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Synchronous, with nodes destroyed in small increments.
+      //************************************************************************
+      {
+         Reclaimer_m reclaimer(false);
+         Tree_m tree;
+         grow(tree,N_ITERATIONS);
+         tree.prune(reclaimer);
+         if(N_ACTIONS != reclaimer.stats().nPending)
+         {
+            std::cout << "Expected pending children of root" << std::endl;
+            return EXIT_FAILURE;
+         }
+         const int MAX_NODES = 10;
+         int nFreed = 0;
+         while(int n = reclaimer.reclaim(MAX_NODES))
+         {
+            if(MAX_NODES<n)
+            {
+               std::cout << "Too many nodes reclaimed in one step" <<
+                  std::endl;
+               return EXIT_FAILURE;
+            }
+            nFreed += n;
+         }
+         if(N_ACTIONS*N_ITERATIONS != nFreed)
+         {
+            std::cout << "Unexpected number of nodes freed: " << nFreed <<
+               std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   //***************************************************************************
+   // Return sucessfully
+   //***************************************************************************
+   return EXIT_SUCCESS;
+}
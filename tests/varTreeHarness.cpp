@@ -0,0 +1,227 @@
+/**
+ * @file varTreeHarness.cpp
+ * Test harness for MCTS with state dependent action sets.
+ */
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "VarTreeNode.h"
+#include "LeafEvalQueue.h"
+
+/**
+ * Private module namespace.
+ */
+namespace {
+
+/**
+ * Depth at which the test process terminates.
+ */
+const int MAX_DEPTH = 6;
+
+/**
+ * Simple process in which the number of legal actions shrinks with depth,
+ * and only even action indices are ever legal.
+ */
+struct ShrinkingMDP_m
+{
+   int depth;
+
+   ShrinkingMDP_m() : depth(0) {}
+
+   /**
+    * Returns the legal actions in the current state.
+    */
+   void legalActions(std::vector<int>& actions) const
+   {
+      actions.clear();
+      if(MAX_DEPTH<=depth)
+      {
+         return;
+      }
+      for(int k=0; k<4-(depth%4); ++k)
+      {
+         actions.push_back(2*k);
+      }
+   }
+
+   /**
+    * Generates a random reward which increases with the action index.
+    * @throws std::logic_error if \c action is not legal.
+    */
+   double operator()(int action)
+   {
+      std::vector<int> legal;
+      legalActions(legal);
+      bool isLegal = false;
+      for(std::size_t k=0; k<legal.size(); ++k)
+      {
+         isLegal = isLegal || (legal[k]==action);
+      }
+      if(!isLegal)
+      {
+         throw std::logic_error("illegal action selected");
+      }
+      ++depth;
+      return action*0.1 + static_cast<double>(rand()%RAND_MAX)/RAND_MAX;
+   }
+};
+
+/**
+ * Value model which assigns the same value to every leaf.
+ */
+struct ConstModel_m
+{
+   void operator()
+   (
+    const std::vector<ShrinkingMDP_m>& leaves,
+    std::vector<double>& values
+   )
+   {
+      for(std::size_t k=0; k<leaves.size(); ++k)
+      {
+         values[k] = 0.5;
+      }
+   }
+};
+
+typedef mcts::VarTreeNode<> Tree_m;
+
+/**
+ * Checks the shape and statistics of a searched tree.
+ * @returns true iff all checks pass.
+ */
+bool checkTree(Tree_m& tree, int nIterations)
+{
+   std::cout << "tree: " << tree << std::endl;
+   std::cout << "Number of Nodes: " << tree.numOfNodes() << std::endl;
+   std::cout << "Max Depth: " << tree.maxDepth() << std::endl;
+
+   if(nIterations != tree.numOfVisits())
+   {
+      std::cout << "Unexpected number of root visits: " <<
+         tree.numOfVisits() << std::endl;
+      return false;
+   }
+
+   if(4 != tree.numOfChildren())
+   {
+      std::cout << "Root should have 4 children" << std::endl;
+      return false;
+   }
+
+   if(MAX_DEPTH+1 < tree.maxDepth())
+   {
+      std::cout << "Tree expanded beyond terminal states" << std::endl;
+      return false;
+   }
+
+   //***************************************************************************
+   // Check that the reported best action has the highest Q value
+   //***************************************************************************
+   int bestAction = tree.bestAction();
+   int correctAction = mcts::NO_ACTION;
+   double bestQ = -std::numeric_limits<double>::max();
+   for(int k=0; k<tree.numOfChildren(); ++k)
+   {
+      if(bestQ<=tree.qValue(k))
+      {
+         bestQ = tree.qValue(k);
+         correctAction = tree.childAction(k);
+      }
+   }
+   if(correctAction!=bestAction)
+   {
+      std::cout << "Wrong best action: " << bestAction << " should be: " <<
+         correctAction << std::endl;
+      return false;
+   }
+   return true;
+
+} // checkTree
+
+} // module namespace
+
+/**
+ * Test harness for VarTreeNode.
+ */
+int main()
+{
+   try
+   {
+      std::srand(std::time(0));
+      const int N_ITERATIONS = 500;
+
+      //************************************************************************
+      // Search using full rollouts
+      //************************************************************************
+      {
+         Tree_m tree;
+         ShrinkingMDP_m mdp;
+         for(int k=0; k<N_ITERATIONS; ++k)
+         {
+            tree.iterate(mdp);
+         }
+         if(!checkTree(tree,N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Check that copies are deep, and reproduce the same tree
+      //************************************************************************
+      {
+         Tree_m tree;
+         ShrinkingMDP_m mdp;
+         tree.iterate(mdp);
+         Tree_m copy(tree);
+         const int N_NODES = copy.numOfNodes();
+         tree.iterate(mdp);
+         if(N_NODES!=copy.numOfNodes() || N_NODES>=tree.numOfNodes())
+         {
+            std::cout << "Copy is not independent of original" << std::endl;
+            return EXIT_FAILURE;
+         }
+         copy = tree;
+         if(copy.numOfNodes()!=tree.numOfNodes())
+         {
+            std::cout << "Assigned copy differs from original" << std::endl;
+            return EXIT_FAILURE;
+         }
+      }
+
+      //************************************************************************
+      // Search using a batched evaluator queue
+      //************************************************************************
+      {
+         Tree_m tree;
+         mcts::LeafEvalQueue<ShrinkingMDP_m,ConstModel_m> queue
+            (ConstModel_m(),16,60.0,false);
+         ShrinkingMDP_m mdp;
+         for(int k=0; k<N_ITERATIONS; ++k)
+         {
+            tree.iterate(mdp,queue,1);
+         }
+         queue.drain();
+         if(!checkTree(tree,N_ITERATIONS))
+         {
+            return EXIT_FAILURE;
+         }
+      }
+
+   }
+   catch(std::exception& e)
+   {
+      std::cout << "Caught error: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+   }
+
+   //***************************************************************************
+   // Return sucessfully
+   //***************************************************************************
+   return EXIT_SUCCESS;
+}